@@ -6,10 +6,13 @@
 #include "diablo.hxx"
 #include "region.hxx"
 #include "loop.hxx"
+#include "traceformat.hxx"
 
 #include <string>
 #include <fstream>
 #include <sstream>
+#include <vector>
+#include <algorithm>
 using namespace std;
 
 //! @brief dump loop nesting hierarchy into a output file stream
@@ -196,6 +199,117 @@ void Cleanup (Region *R, int D)
   //  R->DAG () = NULL;
 }
 
+//! @brief dump the Ball-Larus numbering of a summary region, and of the
+//         regions nested in it, as lines of a .paths table, see
+//         pathtable.hxx
+//  @return false if a child has more paths than a path record holds
+bool DumpPathTable (Region *R, unsigned parent, unsigned child,
+		    uint64_t paths, unsigned &nextId, ostream &pathDump)
+{
+  unsigned id = nextId++;
+  vector<Region *> children;
+  map<Region *, unsigned> index;
+  map<Region *, uint64_t> numPaths;
+  list<Region*> &nodesInTorder = R->DAG()->TopologicalSort ();
+  list<Region*>::iterator N;
+  list<Region*>::reverse_iterator RN;
+
+  pathDump << "region " << dec << id << " " << R->Type () << " " 
+	   << hex << R->StartAddress () << dec << " " << parent << " " 
+	   << child << " " << paths << endl;
+
+  // the child holding the entry comes first, the others in topological
+  // order
+  for (N = nodesInTorder.begin (); N != nodesInTorder.end (); N++)
+    if ((*N)->EntryBlock () == R->EntryBlock ())
+      children.push_back (*N);
+  for (N = nodesInTorder.begin (); N != nodesInTorder.end (); N++)
+    if ((*N)->EntryBlock () != R->EntryBlock ())
+      children.push_back (*N);
+
+  // successors without duplicate edges, as the exits of a nested region
+  // may reach the same region several times
+  vector<vector<Region *> > successors (children.size ());
+  for (unsigned i = 0; i < children.size (); i++)
+    {
+      index[children[i]] = i;
+      FOREACH_SUCC_EDGE_IN_NODE (succE, ((Node *) children[i]))
+	{
+	  Region *S = (Region *) EDGE_TAIL (succE);
+	  if (find (successors[i].begin (), successors[i].end (), S) ==
+	      successors[i].end ())
+	    successors[i].push_back (S);
+	}
+    }
+
+  // paths from each child to the exits, as by EnumerateRegionPaths
+  for (RN = nodesInTorder.rbegin (); RN != nodesInTorder.rend (); RN++)
+    {
+      vector<Region *> &succs = successors[index[*RN]];
+      uint64_t n = R->ExitRegions().find (*RN) != R->ExitRegions().end ();
+      for (unsigned j = 0; j < succs.size (); j++)
+	n += numPaths[succs[j]];
+      if (n > TRACE_PATH_MASK)
+	return false;
+      numPaths[*RN] = n;
+    }
+
+  for (unsigned i = 0; i < children.size (); i++)
+    {
+      Region *S = children[i];
+      if (S->IsSummaryRegion ())
+	{
+	  if (!DumpPathTable (S, id, i, numPaths[S], nextId, pathDump))
+	    return false;
+	  continue;
+	}
+
+      BasicBlock *B = S->EntryBlock ();
+      Instruction *last = B->LastInstruction ();
+      unsigned count = 0;
+      // never executed, and would share its address with the next block
+      if (last == NULL)
+	continue;
+
+      FOREACH_INS_IN_ORDER_IN_BB (I, B)
+	count++;
+      pathDump << "block " << hex << B->StartAddress () << dec << " " 
+	       << last->StartAddress () + INS_OLD_SIZE (last) - 
+		  B->StartAddress () << " " 
+	       << count << " " << (last->IsProcedureCall () ? 1 : 0) << " "
+	       << id << " " << i << " " << numPaths[S] << endl;
+    }
+
+  // increments of the edges of each child, in order, then of its exit
+  for (unsigned i = 0; i < children.size (); i++)
+    {
+      uint64_t increment = 0;
+      for (unsigned j = 0; j < successors[i].size (); j++)
+	{
+	  Region *S = successors[i][j];
+	  pathDump << "edge " << id << " " << i << " " << index[S] << " " 
+		   << increment << endl;
+	  increment += numPaths[S];
+	}
+      if (R->ExitRegions().find (children[i]) != R->ExitRegions().end ())
+	pathDump << "exit " << id << " " << i << " " << increment << endl;
+    }
+  return true;
+}
+
+//! @brief dump the numbering of a function region into the .paths table,
+//         leaving out functions with too many paths
+void DumpPathTable (Region *F, unsigned &nextId, ofstream &pathDump)
+{
+  stringstream function;
+  unsigned id = nextId;
+
+  if (!DumpPathTable (F, 0, 0, 0, id, function))
+    return;
+  pathDump << function.str ();
+  nextId = id;
+}
+
 //! @brief calls set of summary region process functions
 void ProcessHooks (Region *R, int nestingDepth)
 {
@@ -208,6 +322,9 @@ void ProcessHooks (Region *R, int nestingDepth)
 
 int main (int argCount, char **argVector)
 {
+  ofstream pathDump (".paths");
+  unsigned nextRegionId = 1;
+
   DiabloFrameworkInit (argCount, argVector);
 
   for (int i = 1; i < argCount; i++) 
@@ -237,6 +354,7 @@ int main (int argCount, char **argVector)
 	  DumpLoopNesting (F);
 	  Region *regionHierarchy = RegionHierarchy (F);
 	  ProcessRegionHierarchy (regionHierarchy, ProcessHooks);      
+	  DumpPathTable (regionHierarchy, nextRegionId, pathDump);
 	}
     }  
   
@@ -70,6 +70,31 @@ CellSet::Print ()
 }
 
 
+// @brief: like SubtractIfIntersecting, but leaves both sets unchanged
+bool
+CellSet::Intersects (CellSet& cellSet1, list<void *> &dlist)
+{
+  list<Cell> &cells1 = cellSet1.Cells ();
+  list<Cell>::iterator iter, iter1;
+  bool intersects = false;
+
+  iter = cells.begin ();  iter1 = cells1.begin ();
+  while (iter != cells.end () && iter1 != cells1.end ())
+    {
+      if (iter->addr + iter->size <= iter1->addr)
+	iter++;
+      else if (iter1->addr + iter1->size <= iter->addr)
+	iter1++;
+      else
+	{
+	  dlist.push_front (iter->data);
+	  intersects = true;
+	  iter++;
+	}
+    }
+  return intersects;
+}
+
 // @brief: this <- this \ cellSet 1; cellSet1 <- (this ^ cellSet1)
 bool
 CellSet::SubtractIfIntersecting (CellSet& cellSet1, list<void *> &dlist)
@@ -27,6 +27,7 @@ public:
   void Insert (unsigned, unsigned, void *x);
   void Insert (CellSet &);
   bool SubtractIfIntersecting (CellSet &, std::list<void *> &);
+  bool Intersects (CellSet &, std::list<void *> &);
   bool IsEmpty () { return cells.empty (); }
   void Print ();
 };
@@ -84,6 +84,15 @@ Object::Object (char *filename)
   
   object = LinkEmulate (filename, FALSE);
   iCFG = NULL;
+
+  for (int i = 0; i < OBJECT_NCODES (object); i++)
+    immutable[SECTION_CADDRESS (OBJECT_CODE (object)[i])] =
+      SECTION_CADDRESS (OBJECT_CODE (object)[i]) 
+      + SECTION_CSIZE (OBJECT_CODE (object)[i]);
+  for (int i = 0; i < OBJECT_NRODATAS (object); i++)
+    immutable[SECTION_CADDRESS (OBJECT_RODATA (object)[i])] =
+      SECTION_CADDRESS (OBJECT_RODATA (object)[i]) 
+      + SECTION_CSIZE (OBJECT_RODATA (object)[i]);
 }
 
 Object::~Object ()
@@ -110,6 +119,19 @@ CFG *Object::ICFG()
   return iCFG;
 }
 
+//! @return true if [addr, addr + size) lies within a code or read-only
+//          data section, which no instruction of the program can define
+bool
+Object::IsImmutable (Address addr, unsigned size)
+{
+  std::map<Address, Address>::iterator iter = immutable.upper_bound (addr);
+
+  if (iter == immutable.begin ())
+    return false;
+  iter--;
+  return addr + size <= iter->second;
+}
+
 t_ins*
 Instruction::Original ()
 {
@@ -146,6 +168,25 @@ Instruction::IsCall ()
   return iscall;
 }
 
+//! @return true for calls that push a return address, unlike traps
+bool
+Instruction::IsProcedureCall ()
+{
+  bool iscall = false;
+#ifdef DIABLOFLOWGRAPH_I386SUPPORT
+  t_i386_ins *i386_ins = (t_i386_ins *) this;
+
+  switch (I386_INS_OPCODE (i386_ins))
+    {
+    case I386_CALL:
+    case I386_CALLF:
+      iscall = true;
+      break;
+    }
+#endif
+  return iscall;
+}
+
    
 
   
@@ -225,13 +266,26 @@ I386_AddOperandVars (t_i386_operand *op, list<Variable*> &vars)
     }
   else if (I386_OP_TYPE(op) == i386_optype_mem) 
     {
-      V.size = I386_OP_MEMOPSIZE (op);
+      // the naive tracer logs no address for StackVars and MemVars, its
+      // IsStaticOperand must stay in sync with this classification
+      unsigned size = I386_OP_MEMOPSIZE (op);
+      unsigned segment = I386_OP_SEGSELECTOR (op);
+
+      V.size = size;
       if (I386_OP_BASE (op) == I386_REG_EBP && 
-	  I386_OP_INDEX (op) == I386_REG_NONE) 
+	  I386_OP_INDEX (op) == I386_REG_NONE && size < 16 &&
+	  (segment == I386_REG_NONE || segment == I386_REG_SS))
 	{
 	  V.type = StackVar;
 	  V.addrID = (int) I386_OP_IMMEDIATE (op);
 	}
+      else if (I386_OP_BASE (op) == I386_REG_NONE && 
+	       I386_OP_INDEX (op) == I386_REG_NONE && size < 16 &&
+	       (segment == I386_REG_NONE || segment == I386_REG_DS))
+	{
+	  V.type = MemVar;
+	  V.addrID = (int) I386_OP_IMMEDIATE (op);
+	}
       else 
 	{
 	  V.type = DynVar;
@@ -243,7 +297,9 @@ I386_AddOperandVars (t_i386_operand *op, list<Variable*> &vars)
   else if (I386_OP_TYPE(op) == i386_optype_farptr) 
     {
       V.size = I386_OP_MEMOPSIZE (op);
-      if (I386_OP_SEGSELECTOR(op) == I386_REG_DS) 
+      if ((I386_OP_SEGSELECTOR(op) == I386_REG_DS ||
+	   I386_OP_SEGSELECTOR(op) == I386_REG_NONE) && 
+	  I386_OP_MEMOPSIZE (op) < 16)
 	{
 	  V.type = MemVar;
 	  V.addrID = (int) I386_OP_IMMEDIATE(op);
@@ -7,6 +7,7 @@
 
 #include <set>
 #include <list>
+#include <map>
 #include "cellset.hxx"
 
 extern "C" {
@@ -128,6 +129,7 @@ public:
   BasicBlock* EnclBasicBlock () { return (BasicBlock *) INS_BBL (this); }
   Instruction* PrevInstruction () { return (Instruction *) INS_IPREV(this); }
   bool IsCall (); 
+  bool IsProcedureCall ();
   char *StringOut () { return StringIo ("@I", Original ());   }
 };
 
@@ -180,12 +182,15 @@ private:
   char *oname;
   t_object *object;
   CFG *iCFG;
+  //! @brief code & read-only data sections, end address by start address
+  std::map<Address, Address> immutable;
 
 public:
   Object(char *filename);  
   ~Object();              // @TOFIX leak?
   void DisAssemble();   
   CFG *ICFG(); 
+  bool IsImmutable(Address addr, unsigned size);
 };
 
 /*****************************Graph Template Definiton**********************/
@@ -0,0 +1,252 @@
+/*! @file
+ *  pathtable : Ball-Larus numbering of the region DAGs of a program, as
+ *  written to .paths by the analyzer and read by the path mode of the
+ *  tracer & by the slicer. Kept free of pin & diablo headers so that both
+ *  sides can include it.
+ */
+
+#ifndef __PATHTABLE_HXX
+#define __PATHTABLE_HXX
+
+#include <stdint.h>
+#include <vector>
+#include <map>
+#include <string>
+#include <fstream>
+#include <sstream>
+
+// Every summary region of the analyzer gets a region id, from 1 on, and
+// every node of its DAG a child index, 0 for the child holding the entry
+// block of the region. A child is a block, or a summary region nested in
+// it. The paths from a child to the exits of its region are numbered from
+// 0 on: taking the edge to a successor adds the increment of the edge,
+// leaving the region from an exit child adds its exit increment. An
+// execution of a region follows the path numbered by the sum of the
+// increments from its entry child, as by EnumerateRegionPaths of the
+// analyzer, but over distinct edges.
+//
+// .paths is a text file of lines
+//
+//   region <id> <type> <entry> <parent> <child> <paths>
+//   block <address> <bytes> <instructions> <call> <parent> <child> <paths>
+//   edge <region> <from> <to> <increment>
+//   exit <region> <child> <increment>
+//
+// where type is a PATH_REGION_*, a region or block is child number child
+// of region parent, 0 for function regions, paths counts the paths from
+// it to the exits of parent, call is 1 for blocks ending in a call, and
+// addresses are in hex. A region comes before its children, edges &
+// exits.
+
+//! @brief types of regions, as REGION_* of the analyzer
+enum
+{
+  PATH_REGION_ACYCLIC = 0,
+  PATH_REGION_LOOP = 1,
+  PATH_REGION_FUNCTION = 2
+};
+
+#define PATH_NO_EXIT  0xffffffffu
+
+struct PathEdge
+{
+  uint32_t to;
+  uint32_t increment;
+};
+
+struct PathRegion
+{
+  uint32_t type;
+  uint32_t entry;
+  uint32_t parent;
+  uint32_t child;
+  uint32_t paths;
+  // per child: its name in control records, a block address or region
+  // id, the paths from it, its exit increment or PATH_NO_EXIT, and its
+  // edges by increasing increment
+  std::vector<uint32_t> children;
+  std::vector<uint32_t> childPaths;
+  std::vector<uint32_t> exits;
+  std::vector<std::vector<PathEdge> > successors;
+};
+
+struct PathBlock
+{
+  uint32_t address;
+  uint32_t bytes;
+  uint32_t instructions;
+  uint32_t call;
+  uint32_t parent;
+  uint32_t child;
+};
+
+//! @class .paths, read at once
+class PathTable
+{
+  std::vector<PathRegion> regions;         // by id, 0 unused
+  std::map<uint32_t, PathBlock> blocks;    // by address
+
+  bool AddChild (uint32_t parent, uint32_t child, uint32_t name,
+		 uint32_t paths);
+public:
+  bool Load (const char *path);
+  uint32_t Regions () { return regions.size (); }
+  PathRegion &Region (uint32_t id) { return regions[id]; }
+  std::map<uint32_t, PathBlock> &Blocks () { return blocks; }
+  //! @return the block starting at address, NULL if there is none
+  const PathBlock *Block (uint32_t address);
+  //! @return the block holding address, NULL if there is none
+  const PathBlock *Find (uint32_t address);
+  //! @return index of the child of region id named name, PATH_NO_EXIT if
+  //          there is none
+  uint32_t ChildIndex (uint32_t id, uint32_t name);
+  bool Decode (uint32_t id, uint32_t start, uint32_t end, uint32_t path,
+	       std::vector<uint32_t> &children);
+};
+
+inline bool
+PathTable::AddChild (uint32_t parent, uint32_t child, uint32_t name,
+		     uint32_t paths)
+{
+  if (parent == 0)
+    return true;
+  if (parent >= regions.size ())
+    return false;
+
+  PathRegion &R = regions[parent];
+  if (child >= R.children.size ())
+    {
+      R.children.resize (child + 1, 0);
+      R.childPaths.resize (child + 1, 0);
+      R.exits.resize (child + 1, PATH_NO_EXIT);
+      R.successors.resize (child + 1);
+    }
+  R.children[child] = name;
+  R.childPaths[child] = paths;
+  return true;
+}
+
+inline bool
+PathTable::Load (const char *path)
+{
+  std::ifstream file (path);
+  std::string line;
+
+  if (!file)
+    return false;
+  regions.resize (1);
+  while (std::getline (file, line))
+    {
+      std::istringstream fields (line);
+      std::string kind;
+      fields >> kind;
+
+      if (kind == "region")
+	{
+	  uint32_t id;
+	  PathRegion R;
+	  fields >> id >> R.type >> std::hex >> R.entry >> std::dec
+		 >> R.parent >> R.child >> R.paths;
+	  if (!fields || id != regions.size () ||
+	      !AddChild (R.parent, R.child, id, R.paths))
+	    return false;
+	  regions.push_back (R);
+	}
+      else if (kind == "block")
+	{
+	  PathBlock B;
+	  uint32_t paths;
+	  fields >> std::hex >> B.address >> std::dec >> B.bytes
+		 >> B.instructions >> B.call >> B.parent >> B.child >> paths;
+	  if (!fields || !AddChild (B.parent, B.child, B.address, paths))
+	    return false;
+	  blocks[B.address] = B;
+	}
+      else if (kind == "edge" || kind == "exit")
+	{
+	  uint32_t id, from;
+	  PathEdge E;
+	  fields >> id >> from;
+	  if (kind == "edge")
+	    fields >> E.to;
+	  fields >> E.increment;
+	  if (!fields || id >= regions.size () ||
+	      from >= regions[id].children.size ())
+	    return false;
+	  if (kind == "exit")
+	    regions[id].exits[from] = E.increment;
+	  else
+	    regions[id].successors[from].push_back (E);
+	}
+    }
+  return true;
+}
+
+inline const PathBlock *
+PathTable::Block (uint32_t address)
+{
+  std::map<uint32_t, PathBlock>::iterator iter = blocks.find (address);
+  return iter == blocks.end () ? NULL : &iter->second;
+}
+
+inline const PathBlock *
+PathTable::Find (uint32_t address)
+{
+  std::map<uint32_t, PathBlock>::iterator iter = blocks.upper_bound (address);
+
+  if (iter == blocks.begin ())
+    return NULL;
+  iter--;
+  return address < iter->first + iter->second.bytes ? &iter->second : NULL;
+}
+
+inline uint32_t
+PathTable::ChildIndex (uint32_t id, uint32_t name)
+{
+  std::vector<uint32_t> &children = regions[id].children;
+
+  for (uint32_t i = 0; i < children.size (); i++)
+    if (children[i] == name)
+      return i;
+  return PATH_NO_EXIT;
+}
+
+//! @brief walks path through region id from child start, to an exit or
+//         to child end, PATH_NO_EXIT for an exit. Every child takes the
+//         paths from the increment of the edge to it on, so the one to
+//         take next is the last whose increment does not exceed what is
+//         left of path.
+//  @return false if path is not a path of the region
+inline bool
+PathTable::Decode (uint32_t id, uint32_t start, uint32_t end, uint32_t path,
+		   std::vector<uint32_t> &children)
+{
+  PathRegion &R = regions[id];
+  uint32_t node = start;
+
+  children.clear ();
+  for (;;)
+    {
+      if (node >= R.children.size ())
+	return false;
+      children.push_back (node);
+      if (node == end)
+	return true;
+
+      std::vector<PathEdge> &edges = R.successors[node];
+      uint32_t next = PATH_NO_EXIT, increment = 0;
+      for (uint32_t i = 0; i < edges.size (); i++)
+	if (edges[i].increment <= path &&
+	    path - edges[i].increment < R.childPaths[edges[i].to])
+	  {
+	    next = edges[i].to;
+	    increment = edges[i].increment;
+	  }
+      if (next == PATH_NO_EXIT)
+	return R.exits[node] == path && end == PATH_NO_EXIT;
+      path -= increment;
+      node = next;
+    }
+}
+
+#endif
@@ -0,0 +1,410 @@
+/*! @file
+ *  traceformat : on-disk layout of the traces written by the tracer and
+ *  read by the slicer. Kept free of pin & diablo headers so that both
+ *  sides can include it.
+ */
+
+#ifndef __TRACEFORMAT_HXX
+#define __TRACEFORMAT_HXX
+
+#include <stdint.h>
+
+/************************* Trace Header **************************************/
+
+//! @def "DSTR", first word of every versioned trace file
+#define TRACE_MAGIC    0x52545344
+#define TRACE_VERSION  1
+
+enum 
+{ 
+  TRACE_STREAM_CONTROL = 0, 
+  TRACE_STREAM_DATA = 1, 
+  TRACE_STREAM_INDEX = 2,
+  TRACE_STREAM_DEPS = 3,
+  TRACE_STREAM_REPLAY = 4
+};
+
+//! @brief encodings of .trace.data
+enum
+{
+  // (address, size) pairs of 4 bytes each, as in unversioned traces
+  TRACE_DATA_RAW = 0,
+  // chunks of varint coded address deltas, see below
+  TRACE_DATA_COMPACT = 1,
+  // chunks of compact layout holding predictor hits & misses, see below
+  TRACE_DATA_PREDICTED = 2
+};
+
+//! @brief encodings of .trace.control
+enum
+{
+  // address of every executed instruction
+  TRACE_CONTROL_RAW = 0,
+  // (start address, instruction count) pairs of 4 bytes each, one per
+  // executed block of straight-line code. A block may span several
+  // Diablo basic blocks joined by fallthrough.
+  TRACE_CONTROL_BLOCKS = 1,
+  // or'ed to either of the above: chunks of repeat coded records, see
+  // below
+  TRACE_CONTROL_REPEATS = 2,
+  // or'ed to TRACE_CONTROL_BLOCKS: the code of the .paths table of the
+  // analyzer logs path records rather than blocks, see below
+  TRACE_CONTROL_PATHS = 4
+};
+
+//! @brief flags of a trace header
+enum
+{
+  // EBP-relative operands are not logged, and every write of EBP logs
+  // the value EBP had before it, see IsStaticOperand. Absolute operands
+  // are never logged.
+  TRACE_FLAG_STATIC_ELIDED = 1,
+  // framePointer holds EBP at the end of the trace
+  TRACE_FLAG_FRAME_POINTER = 2,
+  // the trace starts after firstInstruction instructions, older history
+  // was dropped by the flight recorder or ran before the region of
+  // interest, or is a segment after the first one
+  TRACE_FLAG_TRUNCATED = 4,
+  // registers holds the registers before the first instruction
+  TRACE_FLAG_REGISTERS = 8,
+  // every call logs, as its last data record, ESP before the call
+  TRACE_FLAG_STACK_POINTER = 16,
+  // loads from pages of code & read-only data of the loaded images log
+  // their address with size 0, as nothing defines them
+  TRACE_FLAG_IMMUTABLE_ELIDED = 32,
+  // stackLimit holds the start of the mapping of the stack the thread
+  // started on, as it was at the end of the trace
+  TRACE_FLAG_STACK_LIMIT = 64
+};
+
+//! @brief registers of a trace header, in the order of their x86 encoding
+enum
+{
+  TRACE_REG_EAX, TRACE_REG_ECX, TRACE_REG_EDX, TRACE_REG_EBX,
+  TRACE_REG_ESP, TRACE_REG_EBP, TRACE_REG_ESI, TRACE_REG_EDI,
+  TRACE_REG_EFLAGS,
+  TRACE_REGISTERS
+};
+
+//! @brief header at offset 0 of a versioned trace file. Files that do not
+//         start with TRACE_MAGIC are unversioned raw traces.
+struct TraceHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t stream;
+  uint32_t encoding;
+  uint32_t thread;
+  uint32_t flags;
+  uint32_t framePointer;
+  uint32_t pad;
+  // counts of the events before the first record of a truncated trace
+  uint64_t firstInstruction;
+  uint64_t firstControlRecord;
+  uint64_t firstDataRecord;
+  // number of the segment, when the tracer splits its output, see -segment
+  uint32_t segment;
+  uint32_t registers[TRACE_REGISTERS];
+  uint32_t stackLimit;
+  uint32_t reserved[7];
+};
+
+/************************* Trace Index ***************************************/
+
+//! @brief entry of .trace.index, a point of the execution where reading of
+//         .trace.control & .trace.data can start, backwards or forwards.
+//         Entries fall on chunk boundaries of the data trace and, in
+//         block mode, on block boundaries of the control trace.
+struct TraceIndexEntry
+{
+  uint64_t instructions;
+  uint64_t controlRecords;
+  uint64_t dataRecords;
+  uint64_t controlOffset;
+  uint64_t dataOffset;
+  uint32_t framePointer;        // EBP at this point
+  uint32_t reserved;
+};
+
+/************************* Events ********************************************/
+
+// Control records at or above TRACE_MARKER_BASE mark events rather than
+// executed instructions; in block mode their instruction count is 0. The
+// k-th data record of an event is logged in slot TraceSlot (marker, k).
+
+#define TRACE_MARKER_BASE  0xfffffff0u
+
+enum
+{
+  // code run without being traced, see -include & -exclude of the tracer.
+  // Logs TRACE_OPAQUE_RECORDS data records: (entry address, EBP at
+  // entry), then the (start, size) bounding boxes of the memory written
+  // near the stack, written elsewhere, read near the stack and read
+  // elsewhere, (0, 0) for an empty box
+  TRACE_MARKER_OPAQUE = TRACE_MARKER_BASE,
+  // a block came to life by a call of malloc, calloc, realloc or mmap.
+  // Logs TRACE_LIFETIME_RECORDS data records: (start, size) of the bytes
+  // the call made live, then (entry address of the allocator, 1 if the
+  // call gave them their contents, as the zeros of calloc or the pages of
+  // mmap, 0 if they are undefined). The bytes a realloc copies are not
+  // included, its tail only.
+  TRACE_MARKER_ALLOC = TRACE_MARKER_BASE + 1,
+  // a block was released by a call of free, realloc or munmap. Logs
+  // records as TRACE_MARKER_ALLOC, with 0 for contents
+  TRACE_MARKER_FREE = TRACE_MARKER_BASE + 2,
+  // a call of memcpy, memmove, memset or strcpy, run untraced. Logs
+  // TRACE_COPY_RECORDS data records: (start, size) of the destination,
+  // (start, size) of the source, (0, 0) for memset, (start, size) of the
+  // arguments on the stack, then (entry address of the routine, 0)
+  TRACE_MARKER_COPY = TRACE_MARKER_BASE + 3
+};
+
+#define TRACE_OPAQUE_RECORDS    5
+#define TRACE_LIFETIME_RECORDS  2
+#define TRACE_COPY_RECORDS      4
+
+/************************* Dependence Graph **********************************/
+
+// .trace.deps is written instead of the control & data traces by the
+// dependence mode of the tracer. Node n of a thread is the n-th
+// instruction it executed, logged as one record:
+//
+//   varint (zigzag (ip - previous ip) << 1 | repeat)  [ count:varint deps ]
+//
+// A dep is the node that last wrote a register or a memory byte used by
+// the instruction, as varint ((n - writer) << 1) for a node of the same
+// thread and as varint (thread << 1 | 1), varint writer for a node of
+// another thread. A repeat record has no count and the very deps of the
+// previous record in its slot TraceSlot (ip, 0), which for the same-thread
+// ones are relative to the node they belong to.
+
+//! @brief dep word tagging a writer of another thread
+inline uint64_t
+TraceDepThread (uint32_t thread)
+{
+  return (uint64_t) thread << 1 | 1;
+}
+
+/************************* Replay Log ****************************************/
+
+// .trace.replay is written instead of the traces by the record mode of the
+// tracer, and read back by its replay mode. It holds the events of a
+// thread that re-execution cannot reproduce, in the order the thread saw
+// them, each a TraceReplayRecord followed, for a system call, by extents
+// (addr:u32, size:u32, size bytes) of the memory the kernel wrote.
+
+enum
+{
+  // number, result & extents of a system call
+  TRACE_REPLAY_SYSCALL = 0,
+  // values holds EAX & EDX after an rdtsc
+  TRACE_REPLAY_RDTSC = 1,
+  // values holds EAX, EBX, ECX & EDX after a cpuid
+  TRACE_REPLAY_CPUID = 2,
+  // signal number delivered after the syscalls-th system call, at the
+  // instruction values[2] with ECX values[3], once the thread had run
+  // values[0] | values[1] << 32 branches, calls & returns
+  TRACE_REPLAY_SIGNAL = 3
+};
+
+struct TraceReplayRecord
+{
+  uint32_t kind;
+  uint32_t number;
+  uint32_t result;
+  uint32_t extents;
+  uint64_t syscalls;
+  uint32_t values[4];
+};
+
+/************************* Repeat Coded Control ******************************/
+
+// A repeat coded control trace is a sequence of chunks, one per flushed
+// trace buffer:
+//
+//   tokens | tokenBytes:u32
+//
+// A token is either a literal record, coded as varint (zigzag (ip -
+// previous literal ip) << 1), followed by the varint instruction count in
+// block mode, or a repeat, coded as varint (k << 1 | 1), varint c. A
+// repeat stands for the k tokens right before it, repeated c more times;
+// repeats among these k tokens only refer to tokens among them. Loop
+// nests thus become nested repeats, which a reader expands lazily while
+// walking the tokens of a chunk backwards.
+
+#define TRACE_REPEAT_TRAILER (sizeof (uint32_t))
+
+/************************* Path Coded Control ********************************/
+
+// In a path coded control trace, the blocks of the code listed in the
+// .paths table, see pathtable.hxx, are logged by execution of the summary
+// regions holding them. Records with an ip below TRACE_PATH_REGIONS,
+// where no code is ever mapped, are then not blocks:
+//
+//   (region id, path | flags)  an execution of the region, logged once it
+//                              is left, after the records of the
+//                              executions nested in it
+//   (TRACE_PATH_RETURN, n)     the call of the last block logged ends
+//                              here, after n region records
+//
+// An execution entered elsewhere than at child 0 has TRACE_PATH_START
+// set, one left elsewhere than at an exit TRACE_PATH_END, and its path is
+// then the sum of the increments from its first to its last child. Its
+// record comes right after (first child, 0) if started, then (last child,
+// instructions executed, 0 for a region) if ended, where a child is
+// named by its block address or region id. The count of the last child
+// has TRACE_PATH_CALLING set for a block whose call has not returned by
+// the end of the trace. An execution has TRACE_PATH_REPEAT set if it
+// follows another of its region within the same child of the enclosing
+// region, as the iterations of a loop after the first.
+//
+// The records of a call, up to its return, are those of the function
+// regions it ran. TRACE_PATH_RETURN is only logged for calls that did
+// not run exactly one of them, as calls of code not in the table, which
+// runs as excluded code.
+
+#define TRACE_PATH_REGIONS  0x10000u
+#define TRACE_PATH_RETURN   0
+#define TRACE_PATH_START    0x80000000u
+#define TRACE_PATH_END      0x40000000u
+#define TRACE_PATH_REPEAT   0x20000000u
+#define TRACE_PATH_MASK     0x1fffffffu
+#define TRACE_PATH_CALLING  0x80000000u
+
+/************************* Compact Data Encoding *****************************/
+
+// A compact data trace is a sequence of self-contained chunks, one per
+// flushed trace buffer:
+//
+//   records | anchors | anchorCount:u32 | recordBytes:u32 | anchorBytes:u32
+//
+// Accesses are grouped into slots by static instruction & operand. Each
+// record holds the varint (zigzag (addr - prev) << 2 | tag), where prev is
+// the previous address in the same slot & chunk (0 at the start of a
+// chunk). The access size is not stored; it only changes between
+// accesses of a slot on a hash collision, in which case the record has
+// tag TRACE_TAG_RESIZE and is preceded by the varint size of the previous
+// access. The anchors are (slot, addr, size) varint triples holding the
+// last access of every slot used in the chunk, which lets a reader decode
+// the records backwards, from the end of the chunk.
+
+#define TRACE_SLOT_BITS  12
+#define TRACE_SLOTS      (1 << TRACE_SLOT_BITS)
+
+enum { TRACE_TAG_SAME = 0, TRACE_TAG_RESIZE = 1 };
+
+#define TRACE_CHUNK_TRAILER (3 * sizeof (uint32_t))
+
+//! @return slot of the k-th memory access logged by instruction at ip
+inline unsigned
+TraceSlot (uint32_t ip, unsigned k)
+{
+  return ((ip * 4 + k) * 2654435761u) >> (32 - TRACE_SLOT_BITS);
+}
+
+inline uint32_t
+TraceZigzag (int32_t v)
+{
+  return ((uint32_t) v << 1) ^ (uint32_t) (v >> 31);
+}
+
+inline int32_t
+TraceUnzigzag (uint32_t v)
+{
+  return (int32_t) (v >> 1) ^ -(int32_t) (v & 1);
+}
+
+//! @brief writes v as a LEB128 varint at p
+//  @return first byte after the varint
+inline uint8_t *
+TraceEncodeVarint (uint8_t *p, uint64_t v)
+{
+  while (v >= 0x80)
+    {
+      *p++ = (uint8_t) (v | 0x80);
+      v >>= 7;
+    }
+  *p++ = (uint8_t) v;
+  return p;
+}
+
+//! @brief reads the varint starting at p
+//  @return first byte after the varint
+inline const uint8_t *
+TraceDecodeVarint (const uint8_t *p, uint64_t &v)
+{
+  unsigned shift = 0;
+  v = 0;
+  do
+    {
+      v |= (uint64_t) (*p & 0x7f) << shift;
+      shift += 7;
+    }
+  while (*p++ & 0x80);
+  return p;
+}
+
+//! @brief reads the varint ending right before end; a varint is only
+//         terminated by a byte with a clear high bit, so stretches of
+//         varints can be walked backwards
+//  @return first byte of the varint
+inline const uint8_t *
+TraceDecodeVarintBefore (const uint8_t *start, const uint8_t *end,
+			 uint64_t &v)
+{
+  const uint8_t *p = end - 1;
+  while (p > start && (*(p - 1) & 0x80))
+    p--;
+  TraceDecodeVarint (p, v);
+  return p;
+}
+
+/************************* Predicted Data Encoding ***************************/
+
+// A predicted data trace has the chunks of a compact one, and the same
+// slots & anchors, but its records are checked guesses. As in the compact
+// encoding, the record of an access yields prev, the access of the slot
+// right before it. It is guessed from next1, the access itself, and next2,
+// the one after it (next1 again for the anchor), walking the chunk
+// backwards as a reader does. The record is a varint (v) of kind v & 3:
+//
+//   TRACE_PRED_STRIDE   prev is next1 - (next2 - next1)
+//   TRACE_PRED_FCM      prev is the access that came before the context
+//                       (next1, next2) the last time, in a table of
+//                       TRACE_FCM_SIZE entries indexed by TraceFcmIndex and
+//                       zeroed at the start of every chunk
+//   TRACE_PRED_DELTA    prev is next1 - zigzag^-1 (v >> 2)
+//   TRACE_PRED_RESIZE   as TRACE_PRED_DELTA, and preceded by the varint size
+//                       of prev, which differs from that of next1
+//
+// A stride or FCM record has in v >> 2 the number of accesses of its slot
+// before it whose records are left out, as they are hits of the same
+// predictor. Every access updates the FCM table, whichever way it is
+// coded. The first access of a slot in a chunk yields address 0 as a
+// delta.
+
+enum 
+{ 
+  TRACE_PRED_STRIDE = 0, 
+  TRACE_PRED_FCM = 1, 
+  TRACE_PRED_DELTA = 2, 
+  TRACE_PRED_RESIZE = 3 
+};
+
+#define TRACE_FCM_BITS  12
+#define TRACE_FCM_SIZE  (1 << TRACE_FCM_BITS)
+
+inline uint32_t
+TraceStride (uint32_t next1, uint32_t next2)
+{
+  return 2 * next1 - next2;
+}
+
+inline unsigned
+TraceFcmIndex (unsigned slot, uint32_t next1, uint32_t next2)
+{
+  return ((next1 ^ (next2 * 31) ^ (slot << 20)) * 2654435761u) 
+    >> (32 - TRACE_FCM_BITS);
+}
+
+#endif
@@ -0,0 +1,142 @@
+/*! @file
+ *  tracering : layout of the shared memory rings through which the tracer
+ *  streams its trace files to a concurrent consumer, see -sink shm of the
+ *  tracer and shmdrain. Kept free of pin & diablo headers so that both
+ *  sides can include it.
+ */
+
+#ifndef __TRACERING_HXX
+#define __TRACERING_HXX
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <sstream>
+
+// Every trace file is streamed through a ring of its own, a shared memory
+// object holding a TraceRing followed by size bytes of messages. The
+// tracer is the only producer and advances head, the consumer is the only
+// reader and advances tail; both count bytes since the start modulo 2^32,
+// so that the ring holds head - tail bytes from offset tail % size on,
+// wrapping at the end. The counts are 32 bits wide, as a 32 bit tracer
+// stores wider ones in two halves that a 64 bit consumer may see apart.
+// A message starts with a TraceMessage and is padded to 8 bytes.
+//
+// When the consumer lags and the ring stays full, the tracer appends the
+// file bytes to <file>.spill in its working directory instead, and once
+// there is room again sends a single TRACE_MESSAGE_SPILL for all of them,
+// which keeps the messages in order.
+//
+// The rings are listed in a registry, the shared memory object named by
+// -shm_name, whose rings are named <registry>.<n>. A slot n of the
+// registry is claimed by the tracer for every file it opens, and given
+// back by the consumer once the ring is closed, drained & removed, so
+// that it serves another file. With no free slot, the tracer writes the
+// file in its working directory instead.
+
+#define TRACE_RING_MAGIC     0x474e5244   // "DRNG"
+#define TRACE_RING_STREAMS   512
+#define TRACE_RING_NAME      64
+#define TRACE_RING_PATH      512
+
+enum
+{
+  // size bytes of the file follow
+  TRACE_MESSAGE_DATA = 0,
+  // the next size bytes of the file are in the spill file, at offset
+  TRACE_MESSAGE_SPILL = 1,
+  // size bytes follow, to overwrite the file at offset
+  TRACE_MESSAGE_PATCH = 2
+};
+
+struct TraceMessage
+{
+  uint32_t kind;
+  uint32_t size;
+  uint64_t offset;
+};
+
+struct TraceRing
+{
+  uint32_t magic;
+  uint32_t size;                // bytes of messages, a power of 2
+  volatile uint32_t closed;     // set once the last message is published
+  uint32_t pad;
+  volatile uint32_t head;
+  uint8_t line[52];             // keeps head & tail on separate lines
+  volatile uint32_t tail;
+  uint8_t reserved[60];
+};
+
+//! @brief states of a stream of the registry
+enum
+{
+  TRACE_RING_FREE = 0,
+  TRACE_RING_CLAIMED = 1,       // by the tracer, ring being created
+  TRACE_RING_READY = 2          // ring created & name set
+};
+
+struct TraceRingRegistry
+{
+  uint32_t magic;
+  volatile uint32_t done;       // set when the tracer exits
+  uint32_t pad[2];
+  char directory[TRACE_RING_PATH];   // working directory of the tracer
+  struct
+  {
+    volatile uint32_t state;
+    char name[TRACE_RING_NAME];
+  } streams[TRACE_RING_STREAMS];
+};
+
+//! @return bytes taken in a ring by a message of size bytes
+inline uint32_t
+TraceMessageBytes (uint32_t size)
+{
+  return (sizeof (TraceMessage) + size + 7) & ~7u;
+}
+
+//! @return path of a shared memory object, for open (2)
+inline std::string
+TraceShmPath (const std::string &name)
+{
+  return "/dev/shm" + name;
+}
+
+//! @return name of the ring of stream n of a registry
+inline std::string
+TraceRingName (const std::string &registry, uint32_t n)
+{
+  std::stringstream name;
+
+  name << registry << "." << n;
+  return name.str ();
+}
+
+//! @brief copies size bytes into a ring at byte count at, wrapping
+inline void
+TraceRingCopyIn (TraceRing *ring, uint32_t at, const void *buffer,
+		 uint32_t size)
+{
+  uint8_t *data = (uint8_t *) (ring + 1);
+  uint32_t start = at & (ring->size - 1);
+  uint32_t first = size < ring->size - start ? size : ring->size - start;
+
+  memcpy (data + start, buffer, first);
+  memcpy (data, (const uint8_t *) buffer + first, size - first);
+}
+
+//! @brief copies size bytes out of a ring from byte count at, wrapping
+inline void
+TraceRingCopyOut (const TraceRing *ring, uint32_t at, void *buffer,
+		  uint32_t size)
+{
+  const uint8_t *data = (const uint8_t *) (ring + 1);
+  uint32_t start = at & (ring->size - 1);
+  uint32_t first = size < ring->size - start ? size : ring->size - start;
+
+  memcpy (buffer, data + start, first);
+  memcpy ((uint8_t *) buffer + first, data, size - first);
+}
+
+#endif
@@ -0,0 +1,387 @@
+/*! @file
+ *  tracestore : content addressed store of trace files. A trace file is
+ *  cut into chunks at boundaries chosen by its contents, every chunk is
+ *  kept once in the store under its hash, and the file itself becomes a
+ *  manifest of its chunks. Traces of runs of the same binary then share
+ *  the chunks of what they have in common, such as startup. Written by
+ *  tracestore & shmdrain, read back by the slicer. Kept free of pin &
+ *  diablo headers so that all sides can include it.
+ */
+
+#ifndef __TRACESTORE_HXX
+#define __TRACESTORE_HXX
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+
+extern "C"
+{
+#include <unistd.h>
+#include <sys/stat.h>
+}
+
+// A chunk ends where the gear hash of the bytes before it has the bits of
+// TRACE_STORE_MASK clear, at least TRACE_STORE_MIN_CHUNK and at most
+// TRACE_STORE_MAX_CHUNK bytes after its start, so that bytes inserted or
+// removed early in a file only change the chunks around them. The mask
+// takes high bits, which depend on the last 64 bytes, as the low bits of
+// the shifted hash depend on the last few bytes only, which repeat in the
+// short records of traces. Chunks are named by the 128 bit hash of their
+// bytes, see TraceStoreHash, and kept in <store>/<first 2 hex digits>/<32
+// hex digits>. The hash is not cryptographic: a chunk is only shared once
+// its bytes are compared, and chunks of the same hash but other bytes get
+// the suffix .<variant>.
+//
+// A manifest is a TraceManifest, then one TraceChunkRef per chunk of the
+// file, in order. The gear table is seeded, and both hashes are fixed, so
+// that every store stays readable & shareable.
+
+#define TRACE_MANIFEST_MAGIC    0x4e414d44   // "DMAN"
+#define TRACE_MANIFEST_VERSION  1
+#define TRACE_STORE_PATH        512
+
+#define TRACE_STORE_MIN_CHUNK   (16 << 10)
+#define TRACE_STORE_MAX_CHUNK   (256 << 10)
+#define TRACE_STORE_MASK        (((1ULL << 16) - 1) << 48)
+
+struct TraceManifest
+{
+  uint32_t magic;
+  uint32_t version;
+  uint64_t size;                // of the file
+  uint32_t chunks;
+  uint32_t reserved;
+  char store[TRACE_STORE_PATH]; // directory of the chunks
+};
+
+struct TraceChunkRef
+{
+  uint64_t hash[2];
+  uint32_t size;
+  uint32_t variant;             // among the chunks of the same hash
+};
+
+//! @return the gear table of the chunker, 256 pseudo-random words
+inline const uint64_t *
+TraceStoreGear ()
+{
+  static uint64_t gear[256];
+  static bool seeded = false;
+
+  if (!seeded)
+    {
+      // splitmix64
+      uint64_t x = 0x5eedc0de5eedc0deULL;
+      for (unsigned i = 0; i < 256; i++)
+	{
+	  uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+	  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	  gear[i] = z ^ (z >> 31);
+	}
+      seeded = true;
+    }
+  return gear;
+}
+
+//! @brief hashes a chunk as two independent 64 bit lanes, FNV-1a and a
+//         multiply & shift mix
+inline void
+TraceStoreHash (const uint8_t *bytes, size_t size, uint64_t hash[2])
+{
+  uint64_t a = 0xcbf29ce484222325ULL, b = size;
+
+  for (size_t i = 0; i < size; i++)
+    {
+      a = (a ^ bytes[i]) * 0x100000001b3ULL;
+      b = (b ^ bytes[i]) * 0x9e3779b97f4a7c15ULL;
+      b ^= b >> 29;
+    }
+  hash[0] = a;
+  hash[1] = b ^ (b >> 32);
+}
+
+inline std::string
+TraceChunkPath (const std::string &store, const TraceChunkRef &ref)
+{
+  char name[48];
+
+  snprintf (name, sizeof (name), "%016llx%016llx",
+	    (unsigned long long) ref.hash[0], (unsigned long long) ref.hash[1]);
+  if (ref.variant != 0)
+    snprintf (name + 32, sizeof (name) - 32, ".%u", ref.variant);
+  return store + "/" + std::string (name, 2) + "/" + name;
+}
+
+//! @brief reads a whole chunk of the store
+inline bool
+TraceLoadChunk (const std::string &store, const TraceChunkRef &ref,
+		std::vector<uint8_t> &bytes)
+{
+  std::ifstream file (TraceChunkPath (store, ref).c_str (),
+		      std::ios::in | std::ios::binary);
+
+  bytes.resize (ref.size);
+  if (ref.size == 0)
+    return true;
+  file.read ((char *) &bytes[0], ref.size);
+  return !file.fail ();
+}
+
+//! @class cuts the bytes of a trace file into the chunks of a store, as
+//         they are written, and writes the manifest of the file on Close.
+//         Chunks are written under a temporary name and renamed, so that
+//         concurrent writers sharing a store never see partial chunks.
+class TraceStoreWriter
+{
+  std::string store;
+  std::string path;
+  std::vector<TraceChunkRef> chunks;
+  uint64_t stored;              // bytes in chunks
+  std::vector<uint8_t> pending; // bytes after the last chunk
+  uint64_t gear;                // hash of the pending bytes
+  bool ok;
+
+  bool Put (const uint8_t *bytes, size_t size, TraceChunkRef &ref);
+  void Cut ();
+public:
+  //! @param store: directory of the chunks, made if missing
+  //  @param path: of the manifest
+  TraceStoreWriter (const std::string &store, const std::string &path);
+  bool Data (const void *buffer, uint32_t size);
+  //! @brief overwrites bytes already written, re-storing the chunks they
+  //         fall in, e.g. for a header completed when the trace ends
+  bool Patch (uint64_t offset, const void *buffer, uint32_t size);
+  bool Close ();
+};
+
+inline
+TraceStoreWriter::TraceStoreWriter (const std::string &s,
+				    const std::string &p)
+  : path (p), stored (0), gear (0), ok (true)
+{
+  char resolved[PATH_MAX];
+
+  // manifests name their store, whatever the directory they are read in
+  mkdir (s.c_str (), 0777);
+  store = realpath (s.c_str (), resolved) ? resolved : s;
+  ok = store.size () < TRACE_STORE_PATH;
+}
+
+//! @brief stores a chunk unless the store has the same bytes already
+inline bool
+TraceStoreWriter::Put (const uint8_t *bytes, size_t size,
+		       TraceChunkRef &ref)
+{
+  struct stat status;
+  std::string chunk;
+  std::vector<uint8_t> stored;
+
+  TraceStoreHash (bytes, size, ref.hash);
+  ref.size = size;
+  for (ref.variant = 0; ; ref.variant++)
+    {
+      chunk = TraceChunkPath (store, ref);
+      if (stat (chunk.c_str (), &status) == 0)
+	{
+	  if ((uint64_t) status.st_size == size &&
+	      TraceLoadChunk (store, ref, stored) &&
+	      (size == 0 || memcmp (&stored[0], bytes, size) == 0))
+	    return true;
+	  continue;
+	}
+
+      // link never replaces a chunk another writer stored meanwhile, which
+      // is compared in turn
+      char suffix[32];
+      snprintf (suffix, sizeof (suffix), ".tmp.%d", (int) getpid ());
+      std::string temporary = chunk + suffix;
+      mkdir (chunk.substr (0, chunk.rfind ('/')).c_str (), 0777);
+      std::ofstream file (temporary.c_str (), std::ios::binary);
+      file.write ((const char *) bytes, size);
+      file.close ();
+      bool linked = !file.fail () && link (temporary.c_str (),
+					   chunk.c_str ()) == 0;
+      int error = errno;
+      unlink (temporary.c_str ());
+      if (linked)
+	return true;
+      if (file.fail () || error != EEXIST)
+	return false;
+      ref.variant--;
+    }
+}
+
+//! @brief ends a chunk with the pending bytes
+inline void
+TraceStoreWriter::Cut ()
+{
+  TraceChunkRef ref;
+
+  if (pending.empty ())
+    return;
+  ok &= Put (&pending[0], pending.size (), ref);
+  chunks.push_back (ref);
+  stored += pending.size ();
+  pending.clear ();
+  gear = 0;
+}
+
+inline bool
+TraceStoreWriter::Data (const void *buffer, uint32_t size)
+{
+  const uint8_t *bytes = (const uint8_t *) buffer;
+  const uint64_t *table = TraceStoreGear ();
+
+  for (uint32_t i = 0; i < size; i++)
+    {
+      pending.push_back (bytes[i]);
+      gear = (gear << 1) + table[bytes[i]];
+      if ((pending.size () >= TRACE_STORE_MIN_CHUNK &&
+	   (gear & TRACE_STORE_MASK) == 0) ||
+	  pending.size () >= TRACE_STORE_MAX_CHUNK)
+	Cut ();
+    }
+  return ok;
+}
+
+inline bool
+TraceStoreWriter::Patch (uint64_t offset, const void *buffer,
+			 uint32_t size)
+{
+  const uint8_t *bytes = (const uint8_t *) buffer;
+  uint64_t start = 0;
+  std::vector<uint8_t> chunk;
+
+  if (offset + size > stored + pending.size ())
+    return false;
+  for (size_t i = 0; i < chunks.size () && offset < stored; i++)
+    {
+      uint64_t limit = start + chunks[i].size;
+      if (offset < limit && offset + size > start)
+	{
+	  uint64_t from = std::max (offset, start);
+	  uint64_t to = std::min (offset + size, limit);
+	  if (!TraceLoadChunk (store, chunks[i], chunk))
+	    return ok = false;
+	  memcpy (&chunk[from - start], bytes + (from - offset), to - from);
+	  ok &= Put (&chunk[0], chunk.size (), chunks[i]);
+	}
+      start = limit;
+    }
+  if (offset + size > stored)
+    {
+      uint64_t from = std::max (offset, stored);
+      memcpy (&pending[from - stored], bytes + (from - offset),
+	      offset + size - from);
+    }
+  return ok;
+}
+
+inline bool
+TraceStoreWriter::Close ()
+{
+  TraceManifest manifest;
+  std::string temporary = path + ".manifest";
+
+  Cut ();
+  if (!ok)
+    return false;
+
+  memset (&manifest, 0, sizeof (manifest));
+  manifest.magic = TRACE_MANIFEST_MAGIC;
+  manifest.version = TRACE_MANIFEST_VERSION;
+  manifest.size = stored;
+  manifest.chunks = chunks.size ();
+  strncpy (manifest.store, store.c_str (), TRACE_STORE_PATH - 1);
+
+  std::ofstream file (temporary.c_str (), std::ios::binary);
+  file.write ((const char *) &manifest, sizeof (manifest));
+  if (!chunks.empty ())
+    file.write ((const char *) &chunks[0],
+		chunks.size () * sizeof (TraceChunkRef));
+  file.close ();
+  if (file.fail () || rename (temporary.c_str (), path.c_str ()) != 0)
+    {
+      unlink (temporary.c_str ());
+      return false;
+    }
+  return true;
+}
+
+//! @class reads a file of the store through its manifest, at any offset.
+//         The last chunk read is kept, as trace readers walk a file
+//         backwards by windows smaller than a chunk.
+class TraceStoreReader
+{
+  std::string store;
+  std::vector<TraceChunkRef> chunks;
+  std::vector<uint64_t> starts; // offset of every chunk, then the size
+  size_t cached;
+  std::vector<uint8_t> cache;
+public:
+  TraceStoreReader () : cached (~(size_t) 0) {}
+  //! @return false if path is not a manifest
+  bool Open (const char *path);
+  uint64_t Size () { return starts.empty () ? 0 : starts.back (); }
+  bool Read (uint64_t offset, char *buffer, size_t size);
+};
+
+inline bool
+TraceStoreReader::Open (const char *path)
+{
+  std::ifstream file (path, std::ios::in | std::ios::binary);
+  TraceManifest manifest;
+
+  file.read ((char *) &manifest, sizeof (manifest));
+  if (file.fail () || manifest.magic != TRACE_MANIFEST_MAGIC ||
+      manifest.version != TRACE_MANIFEST_VERSION)
+    return false;
+  manifest.store[TRACE_STORE_PATH - 1] = 0;
+  store = manifest.store;
+  chunks.resize (manifest.chunks);
+  if (!chunks.empty ())
+    file.read ((char *) &chunks[0], chunks.size () * sizeof (TraceChunkRef));
+  if (file.fail ())
+    return false;
+
+  starts.assign (1, 0);
+  for (size_t i = 0; i < chunks.size (); i++)
+    starts.push_back (starts.back () + chunks[i].size);
+  cached = ~(size_t) 0;
+  return starts.back () == manifest.size;
+}
+
+inline bool
+TraceStoreReader::Read (uint64_t offset, char *buffer, size_t size)
+{
+  if (offset + size > Size ())
+    return false;
+  while (size > 0)
+    {
+      size_t i = std::upper_bound (starts.begin (), starts.end (), offset) -
+	starts.begin () - 1;
+      if (i != cached)
+	{
+	  if (!TraceLoadChunk (store, chunks[i], cache))
+	    return false;
+	  cached = i;
+	}
+      size_t n = std::min ((uint64_t) size, starts[i + 1] - offset);
+      memcpy (buffer, &cache[offset - starts[i]], n);
+      buffer += n;
+      offset += n;
+      size -= n;
+    }
+  return true;
+}
+
+#endif
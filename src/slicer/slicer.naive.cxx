@@ -1,10 +1,14 @@
 
 #include "diablo.hxx"
 #include "cellset.hxx"
+#include "tracereader.hxx"
 
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <vector>
+#include <map>
+#include <algorithm>
 using namespace std;
 
 extern "C" 
@@ -20,11 +24,16 @@ struct
 slicingCriterion;
 
 CFG *iCFG;
-ifstream traceData;
-ifstream traceControl;
+//! @brief the sliced program, whose code & read-only data never need
+//         explaining
+Object *program;
+DataTrace traceData;
+ControlTrace traceControl;
+//! @brief all instructions of the CFG by address
+map<Address, Instruction*> insIndex;
 
-Instruction*
-SearchInstruction (Address addr)
+void
+IndexInstructions ()
 {
   FOREACH_FUNCTION_IN_CFG (F, iCFG)
     {
@@ -32,15 +41,52 @@ SearchInstruction (Address addr)
 	{
 	  FOREACH_INS_IN_REV_ORDER_IN_BB (I, BB)
 	    {
-	      if (I->StartAddress () == addr)
-		{
-		  return I;
-		}
+	      insIndex[I->StartAddress ()] = I;
 	    }
 	}
     }
+}
+
+Instruction*
+SearchInstruction (Address addr)
+{
+  map<Address, Instruction*>::iterator iter = insIndex.find (addr);
+
   // should not be reachable!
-  assert (0);
+  assert (iter != insIndex.end ());
+  return iter->second;
+}
+
+//! @brief steps back to the previous instruction of the control trace,
+//         expanding block records into their instructions
+bool
+PrevInstruction (uint32_t &addr)
+{
+  static vector<uint32_t> block;
+  uint32_t start, count;
+
+  if (block.empty ())
+    {
+      if (!traceControl.Prev (start, count))
+	return false;
+      // events log no instructions
+      if (count <= 1)
+	{
+	  addr = start;
+	  return true;
+	}
+      // a block is straight-line code, possibly falling through into the
+      // next basic block
+      map<Address, Instruction*>::iterator iter = insIndex.find (start);
+      for (; count > 0; count--, iter++)
+	{
+	  assert (iter != insIndex.end ());
+	  block.push_back (iter->first);
+	}
+    }
+  addr = block.back ();
+  block.pop_back ();
+  return true;
 }
 
 Instruction*
@@ -79,6 +125,85 @@ LookupInstruction (Address addr)
   return foundInstruction;
 }
 
+//! @brief frame pointer before the instruction being sliced, tracked 
+//         backwards for traces without addresses of StackVars
+bool staticElided;
+bool framePointerKnown;
+uint32_t framePointer;
+
+//! @brief ESP before the call being sliced, 0 for other instructions, &
+//         the lowest ESP seen at calls so far, for traces logging ESP at
+//         calls. Leaf frames, which log no ESP, are assumed to reach at
+//         most stackLeafSlack bytes below the lowest ESP, see -s. The
+//         stack lies above stackLimit, when the tracer logged it.
+bool stackPointerLogged;
+uint32_t callStackPointer;
+uint32_t lowestStackPointer = ~0u;
+uint32_t stackLeafSlack = 0x10000;
+uint32_t stackLimit;
+
+//! @return true if the address of V is logged in .trace.data; MemVars
+//          are absolute, and never logged
+bool
+IsTraced (Variable *V)
+{
+  if (staticElided)
+    return V->type == DynVar;
+  return V->type == DynVar || V->type == StackVar;
+}
+
+bool
+DefinesFramePointer (Instruction *I)
+{
+  list<Variable*>& D = I->VarDefs ();
+  list<Variable*>::iterator iter;
+
+  for (iter = D.begin (); iter != D.end (); iter++)
+    if ((*iter)->type == RegVar && (*iter)->addrID / 4 == I386_REG_EBP)
+      return true;
+  return false;
+}
+
+//! @return number of records of I in .trace.data
+unsigned
+TracedVarCount (Instruction *I)
+{
+  list<Variable*>& D = I->VarDefs ();
+  list<Variable*>& U = I->VarUses ();
+  list<Variable*>::iterator iter;
+  unsigned count = 0;
+
+  for (iter = D.begin (); iter != D.end (); iter++)
+    if (IsTraced (*iter))
+      count++;
+  for (iter = U.begin (); iter != U.end (); iter++)
+    if (IsTraced (*iter))
+      count++;
+  if (staticElided && DefinesFramePointer (I))
+    count++;
+  if (stackPointerLogged && I->IsProcedureCall ())
+    count++;
+  return count;
+}
+
+//! @return cell of a StackVar or MemVar
+Cell
+StaticCell (Variable *V, Instruction *I)
+{
+  if (V->type == StackVar)
+    {
+      if (!framePointerKnown)
+	{
+	  cerr << "frame pointer unknown at " << (void *) I->StartAddress () 
+	       << endl;
+	  assert (0);
+	}
+      return Cell (framePointer + V->addrID, V->size, 
+		   (void *) I->StartAddress ());
+    }
+  return Cell (V->addrID, V->size, (void *) I->StartAddress ());
+}
+
 void
 VarsUsed(Address addr, CellSet &regsUsed, CellSet &memsUsed, 
 	 CellSet &regsDefined, CellSet &memsDefined)
@@ -101,22 +226,21 @@ VarsUsed(Address addr, CellSet &regsUsed, CellSet &memsUsed,
 	  if (I->IsVarUsedBy (V, regsDefined, memsDefined))
 	    regsUsed.Insert (C.addr, C.size, C.data);
 	}
-      else if (V->type == MemVar && V->addrID != 0)
+      else if (!IsTraced (V))
 	{
-	  if (I->IsVarUsedBy (V, regsDefined, memsDefined))
+	  C = StaticCell (V, I);
+	  if (I->IsVarUsedBy (V, regsDefined, memsDefined) &&
+	      !program->IsImmutable (C.addr, C.size))
 	    memsUsed.Insert (C.addr, C.size, C.data);
 	}
       else
 	{
-	  traceData.seekg (-1 * (int) sizeof (C.size), ios::cur);
-	  assert (!traceData.fail ());	    
-	  traceData.read ((char *) &C.size, sizeof (C.size));
-	  traceData.seekg (-1 * (int) sizeof (C.size), ios::cur);
-	  traceData.seekg (-1 * (int) sizeof (C.addr), ios::cur);
-	  assert (!traceData.fail ());
-	  traceData.read ((char *) &C.addr, sizeof(C.addr));
-	  traceData.seekg (-1 * (int) sizeof (C.addr), ios::cur);
-	  if (I->IsVarUsedBy (V, regsDefined, memsDefined))
+	  bool found = traceData.Prev (C.addr, C.size);
+	  assert (found);
+	  // a load of code or read-only data is logged with size 0 by
+	  // tracers eliding them, see TRACE_FLAG_IMMUTABLE_ELIDED
+	  if (C.size && I->IsVarUsedBy (V, regsDefined, memsDefined) &&
+	      !program->IsImmutable (C.addr, C.size))
 	    memsUsed.Insert (C.addr, C.size, C.data);
 	  // cout << "(R " << (void *) C.addr << "," << C.size << " ) " 
 	  //     << (void *) addr << endl;
@@ -133,26 +257,47 @@ VarsDefined (Address addr, CellSet& regsDefined, CellSet& memsDefined)
   Instruction *I = LookupInstruction (addr);
   list<Variable*>& D = I->VarDefs ();
   list<Variable*>::iterator iter;
+
+  // defs are always visited first, announce all records of the instruction
+  traceData.Instruction (addr, TracedVarCount (I));
+
+  // the last record of a call holds ESP before it
+  callStackPointer = 0;
+  if (stackPointerLogged && I->IsProcedureCall ())
+    {
+      unsigned size;
+      bool found = traceData.Prev (callStackPointer, size);
+      assert (found);
+      if (callStackPointer < lowestStackPointer)
+	lowestStackPointer = callStackPointer;
+    }
+
+  // the last record of a write of EBP holds the value it overwrites, which
+  // is the frame pointer all StackVars of the instruction are relative to
+  if (staticElided && DefinesFramePointer (I))
+    {
+      unsigned size;
+      bool found = traceData.Prev (framePointer, size);
+      assert (found);
+      framePointerKnown = true;
+    }
+
   for (iter = D.begin (); iter != D.end (); iter++)
     {
       Variable *V = *iter;
       if (V->type == RegVar)
 	regsDefined.Insert ((unsigned) V->addrID, (unsigned) V->size, 
 			    (void *) I->StartAddress ());
-      else if (V->type == MemVar && V->addrID != 0)
-	memsDefined.Insert ((unsigned) V->addrID, (unsigned) V->size,
-			    (void *) I->StartAddress ());
+      else if (!IsTraced (V))
+	{
+	  Cell C = StaticCell (V, I);
+	  memsDefined.Insert (C.addr, C.size, C.data);
+	}
       else 
 	{
-	  unsigned size;  Address data;
-	  traceData.seekg (-1 * (int) sizeof (size), ios::cur);
-	  assert (!traceData.fail ());	    
-	  traceData.read ((char *) &size, sizeof (size));
-	  traceData.seekg (-1 * (int) sizeof (size), ios::cur);
-	  traceData.seekg (-1 * (int) sizeof (data), ios::cur);
-	  assert (!traceData.fail ());
-	  traceData.read ((char *) &data, sizeof (data));
-	  traceData.seekg (-1 * (int) sizeof (data), ios::cur);
+	  unsigned size, data;
+	  bool found = traceData.Prev (data, size);
+	  assert (found);
 	  memsDefined.Insert ( (unsigned) data, size, 
 			       (void *) I->StartAddress ());
 	  //  cout << "(W " << (void *) data << "," << size << " ) " 
@@ -162,46 +307,250 @@ VarsDefined (Address addr, CellSet& regsDefined, CellSet& memsDefined)
   return;
 }
 
+//! @brief reads the summary of a stretch of code run untraced, see
+//         TRACE_MARKER_OPAQUE. Excluded code is assumed to keep to the
+//         calling convention: it may define EAX, ECX & EDX and use these,
+//         ESP and the memory it read.
+//  @return entry address of the excluded code
+Address
+VarsOfOpaque (uint32_t marker, CellSet &regsUsed, CellSet &memsUsed,
+	      CellSet &regsDefined, CellSet &memsDefined)
+{
+  unsigned addr[TRACE_OPAQUE_RECORDS], size[TRACE_OPAQUE_RECORDS];
+  static const unsigned scratch[] = 
+    { I386_REG_EAX, I386_REG_ECX, I386_REG_EDX };
+
+  traceData.Instruction (marker, TRACE_OPAQUE_RECORDS);
+  for (int k = TRACE_OPAQUE_RECORDS - 1; k >= 0; k--)
+    {
+      bool found = traceData.Prev (addr[k], size[k]);
+      assert (found);
+    }
+  void *entry = (void *) addr[0];
+
+  // EBP is unchanged across excluded code called by traced code
+  framePointer = size[0];
+  framePointerKnown = true;
+
+  regsUsed.Clear ();
+  memsUsed.Clear ();
+  regsDefined.Clear ();
+  memsDefined.Clear ();
+  for (unsigned i = 0; i < sizeof (scratch) / sizeof (scratch[0]); i++)
+    {
+      regsDefined.Insert (scratch[i] * 4, 4, entry);
+      regsUsed.Insert (scratch[i] * 4, 4, entry);
+    }
+  regsUsed.Insert (I386_REG_ESP * 4, 4, entry);
+  for (unsigned k = 1; k < 3; k++)
+    if (size[k])
+      memsDefined.Insert (addr[k], size[k], entry);
+  for (unsigned k = 3; k < TRACE_OPAQUE_RECORDS; k++)
+    if (size[k])
+      memsUsed.Insert (addr[k], size[k], entry);
+  return addr[0];
+}
+
+//! @brief reads a lifetime event, see TRACE_MARKER_ALLOC
+//  @return entry address of the allocator; block & defined are set to the
+//          bytes of the event & whether the call gave them their contents
+Address
+VarsOfLifetime (uint32_t marker, CellSet &block, bool &defined)
+{
+  unsigned addr[TRACE_LIFETIME_RECORDS], size[TRACE_LIFETIME_RECORDS];
+
+  traceData.Instruction (marker, TRACE_LIFETIME_RECORDS);
+  for (int k = TRACE_LIFETIME_RECORDS - 1; k >= 0; k--)
+    {
+      bool found = traceData.Prev (addr[k], size[k]);
+      assert (found);
+    }
+
+  block.Clear ();
+  block.Insert (addr[0], size[0], (void *) addr[1]);
+  defined = size[1] != 0;
+  return addr[1];
+}
+
+//! @brief reads a call of a copy routine, see TRACE_MARKER_COPY, as one
+//         instruction defining the destination from the source & the
+//         arguments. Like excluded code, it may define EAX, ECX & EDX.
+//  @return entry address of the routine
+Address
+VarsOfCopy (uint32_t marker, CellSet &regsUsed, CellSet &memsUsed,
+	    CellSet &regsDefined, CellSet &memsDefined)
+{
+  unsigned addr[TRACE_COPY_RECORDS], size[TRACE_COPY_RECORDS];
+  static const unsigned scratch[] = 
+    { I386_REG_EAX, I386_REG_ECX, I386_REG_EDX };
+
+  traceData.Instruction (marker, TRACE_COPY_RECORDS);
+  for (int k = TRACE_COPY_RECORDS - 1; k >= 0; k--)
+    {
+      bool found = traceData.Prev (addr[k], size[k]);
+      assert (found);
+    }
+  void *entry = (void *) addr[3];
+
+  regsUsed.Clear ();
+  memsUsed.Clear ();
+  regsDefined.Clear ();
+  memsDefined.Clear ();
+  for (unsigned i = 0; i < sizeof (scratch) / sizeof (scratch[0]); i++)
+    regsDefined.Insert (scratch[i] * 4, 4, entry);
+  regsUsed.Insert (I386_REG_ESP * 4, 4, entry);
+  if (size[0])
+    memsDefined.Insert (addr[0], size[0], entry);
+  for (unsigned k = 1; k < 3; k++)
+    if (size[k] && !program->IsImmutable (addr[k], size[k]))
+      memsUsed.Insert (addr[k], size[k], entry);
+  return addr[3];
+}
+
+//! @brief drops the memory below ESP before a call from a to-explain set:
+//         the frames there are created after the call, so nothing older
+//         defines them. Only the stack seen so far is dropped, down to
+//         the lowest ESP at a call less stackLeafSlack, and never below
+//         stackLimit, which keeps off memory mapped below the stack.
+void
+DropDeadStack (CellSet &toExplain, uint32_t stackPointer)
+{
+  CellSet dead;
+  list<void *> cause;
+  uint32_t low = lowestStackPointer > stackLeafSlack ?
+    lowestStackPointer - stackLeafSlack : 0;
+
+  low = max (low, stackLimit);
+  if (low >= stackPointer)
+    return;
+  dead.Insert (low, stackPointer - low, NULL);
+  toExplain.SubtractIfIntersecting (dead, cause);
+}
+
+//! @return name of the dependence graph of a thread
+string
+DepGraphName (uint32_t thread)
+{
+  stringstream name;
+
+  name << ".trace.deps";
+  if (thread != 0)
+    name << "." << thread;
+  return name.str ();
+}
+
+//! @brief reports the cells of cause the excluded code, copy or
+//         allocation of a marker record defines, by the entry of its
+//         routine
+void
+PrintMarkerCause (uint32_t marker, Address entry, list<void *> &cause)
+{
+  const char *kind = marker == TRACE_MARKER_OPAQUE ? "opaque" :
+    marker == TRACE_MARKER_COPY ? "copy" : "alloc";
+
+  cerr << kind << " " << (void *) entry << "::" << "{";
+  for (list<void *>::iterator iter = cause.begin ();
+       iter != cause.end (); iter++)
+    cerr << (void *) (*iter) << " ";
+  cerr << "}" << endl;
+}
+
 set<Address>&
 DynamicSlice ()
 {
-  Address addr;
+  uint32_t addr;
+  bool found = false;
   static set<Address> slice;
   static CellSet regsD, memsD, regsU, memsU;
   static CellSet toExplainMems, toExplainRegs;
 
-  traceControl.seekg (0, ios::end);
-  traceData.seekg (0, ios::end);
-  
-  while (true)
+  while (PrevInstruction (addr))
     {
-      traceControl.seekg (-1 * (int) sizeof (addr), ios::cur);
-      if (traceControl.fail ())
-	break;
-      traceControl.read ((char *) &addr, sizeof (addr));
+      if (addr == TRACE_MARKER_OPAQUE)
+	{
+	  VarsOfOpaque (addr, regsU, memsU, regsD, memsD);
+	  continue;
+	}
+      if (addr == TRACE_MARKER_COPY)
+	{
+	  VarsOfCopy (addr, regsU, memsU, regsD, memsD);
+	  continue;
+	}
+      if (addr >= TRACE_MARKER_BASE)
+	{
+	  bool defined;
+	  VarsOfLifetime (addr, memsD, defined);
+	  continue;
+	}
       if (addr == slicingCriterion.statement)
 	slicingCriterion.instance++;      
       VarsDefined (addr, regsD, memsD);
       VarsUsed (addr, regsU, memsU, regsD, memsD);
-      traceControl.seekg (-1 * (int) sizeof (addr), ios::cur); 
       if (slicingCriterion.instance == 1)
 	{
 	  toExplainRegs.Insert (regsU);
 	  toExplainMems.Insert (memsU);
+	  found = true;
 	  break;
 	}	
     }
 
-  if (traceControl.fail ())
+  if (!found)
     return slice;
 
-  while (true)
+  while (PrevInstruction (addr))
     {
       list<void *> cause;
-      traceControl.seekg (-1 * (int) sizeof (addr), ios::cur);
-      if (traceControl.fail ())
-	break;
-      traceControl.read ((char *) &addr, sizeof (addr));      
+
+      // excluded code may or may not have defined what its summary 
+      // covers, so it explains nothing away
+      if (addr == TRACE_MARKER_OPAQUE)
+	{
+	  Address entry = VarsOfOpaque (addr, regsU, memsU, regsD, memsD);
+	  bool rD = toExplainRegs.Intersects (regsD, cause);
+	  bool mD = toExplainMems.Intersects (memsD, cause);
+	  if (rD || mD)
+	    {
+	      PrintMarkerCause (addr, entry, cause);
+	      toExplainRegs.Insert (regsU);
+	      toExplainMems.Insert (memsU);
+	      slice.insert (entry);
+	    }
+	  continue;
+	}
+
+      // a copy is a single instruction over whole ranges
+      if (addr == TRACE_MARKER_COPY)
+	{
+	  Address entry = VarsOfCopy (addr, regsU, memsU, regsD, memsD);
+	  bool rD = toExplainRegs.SubtractIfIntersecting (regsD, cause);
+	  bool mD = toExplainMems.SubtractIfIntersecting (memsD, cause);
+	  if (rD || mD)
+	    {
+	      PrintMarkerCause (addr, entry, cause);
+	      toExplainRegs.Insert (regsU);
+	      toExplainMems.Insert (memsU);
+	      slice.insert (entry);
+	    }
+	  continue;
+	}
+
+      // nothing older than the call defines the bytes of a fresh block:
+      // they are explained by the allocator, if it gave them contents, or
+      // read undefined
+      if (addr >= TRACE_MARKER_BASE)
+	{
+	  bool defined;
+	  Address entry = VarsOfLifetime (addr, memsD, defined);
+	  if (addr == TRACE_MARKER_ALLOC &&
+	      toExplainMems.SubtractIfIntersecting (memsD, cause) && defined)
+	    {
+	      PrintMarkerCause (addr, entry, cause);
+	      slice.insert (entry);
+	    }
+	  continue;
+	}
+
       VarsDefined (addr, regsD, memsD);
       bool rD = toExplainRegs.SubtractIfIntersecting (regsD, cause);
       bool mD = toExplainMems.SubtractIfIntersecting (memsD, cause);
@@ -217,17 +566,88 @@ DynamicSlice ()
 	  toExplainMems.Insert (memsU);
 	  slice.insert (addr);	  
 	}
-      traceControl.seekg (-1 * (int) sizeof (addr), ios::cur);
+      if (callStackPointer)
+	DropDeadStack (toExplainMems, callStackPointer);
+    }
+
+  return slice;
+}
+
+//! @brief slices the dependence graph of the tracer's dependence mode,
+//         loading the graphs of other threads as their nodes are reached
+set<Address>&
+GraphSlice (const string &tracePath, uint32_t thread, long long endCount)
+{
+  static set<Address> slice;
+  map<uint32_t, DepGraph*> graphs;
+  map<uint32_t, vector<bool> > visited;
+  vector<DepRef> worklist;
+
+  string path = tracePath + "/" + DepGraphName (thread);
+  graphs[thread] = new DepGraph;
+  if (!graphs[thread]->Open (path.c_str ()))
+    {
+      cerr << "could not read .trace.deps in given path\n";
+      return slice;
     }
 
+  // the criterion is found walking backwards, as by DynamicSlice
+  DepGraph *graph = graphs[thread];
+  uint64_t n = graph->Nodes ();
+  if (endCount >= 0 && (uint64_t) endCount < n)
+    n = endCount;
+  while (n-- > 0)
+    {
+      if (graph->Ip (n) == slicingCriterion.statement)
+	slicingCriterion.instance++;
+      if (slicingCriterion.instance == 1)
+	break;
+    }
+  if (slicingCriterion.instance != 1)
+    return slice;
+
+  DepRef criterion = { thread, n };
+  worklist.push_back (criterion);
+  while (!worklist.empty ())
+    {
+      DepRef node = worklist.back ();
+      worklist.pop_back ();
+
+      graph = graphs[node.thread];
+      if (graph == NULL)
+	{
+	  path = tracePath + "/" + DepGraphName (node.thread);
+	  graph = graphs[node.thread] = new DepGraph;
+	  if (!graph->Open (path.c_str ()))
+	    {
+	      cerr << "could not read .trace.deps of thread " << node.thread
+		   << ", its dependences are missing from the slice" << endl;
+	      continue;
+	    }
+	}
+      if (node.node >= graph->Nodes ())
+	continue;
+      vector<bool> &seen = visited[node.thread];
+      seen.resize (graph->Nodes ());
+      if (seen[node.node])
+	continue;
+      seen[node.node] = true;
+
+      if (node.thread != criterion.thread || node.node != criterion.node)
+	slice.insert (graph->Ip (node.node));
+      for (uint64_t i = graph->DepsBegin (node.node); 
+	   i < graph->DepsBegin (node.node + 1); i++)
+	worklist.push_back (graph->Dep (i));
+    }
   return slice;
 }
 
 void
 Usage (char *progName)
 {
-  cerr << "Usage: " << progName << " -S <address> [-i <integer>] -T <path>" 
-       << endl;
+  cerr << "Usage: " << progName << " -S <address> [-i <integer>] -t <path>" 
+       << " [-n <thread>] [-e <instructions>] [-g] [-p <.paths>]"
+       << " [-s <bytes>] <binary>" << endl;
 }  
 
 void
@@ -252,15 +672,23 @@ int
 main (int argCount, char **argVector)
 {
   int option;
+  string tracePath (".");
+  string threadSuffix;
   string traceDataFile;
   string traceControlFile;
+  string traceIndexFile;
+  string pathTableFile;
+  PathTable pathTable;
+  long long endCount = -1;
+  uint32_t thread = 0;
+  bool graphMode = false;
 
 
   DiabloFrameworkInit (argCount, argVector);
 
   RemoveNullOptions (argCount, argVector);
 
-  while ((option = getopt (argCount, argVector, "t:S:i:")) != -1)
+  while ((option = getopt (argCount, argVector, "t:S:i:n:e:gp:s:")) != -1)
     switch (option)
       {
       case 'S':
@@ -270,13 +698,30 @@ main (int argCount, char **argVector)
 	slicingCriterion.instance = strtol (optarg, NULL, 0);
 	break;
       case 't':
-	traceDataFile = optarg;
-	traceControlFile = optarg;
-	traceDataFile.append ("/.trace.data");
-	traceControlFile.append ("/.trace.control");
-	traceData.open (traceDataFile.c_str ());
-	traceControl.open (traceControlFile.c_str ());
+	tracePath = optarg;
 	break;	
+      case 'n':
+	// the main thread's trace files carry no thread suffix
+	thread = strtol (optarg, NULL, 0);
+	if (thread != 0)
+	  threadSuffix = string (".") + optarg;
+	break;
+      case 'e':
+	// slice backwards from the point reached after so many instructions
+	endCount = strtoll (optarg, NULL, 0);
+	break;
+      case 'g':
+	// slice .trace.deps of the tracer's dependence mode
+	graphMode = true;
+	break;
+      case 'p':
+	// the table of the analyzer a path coded trace was logged with
+	pathTableFile = optarg;
+	break;
+      case 's':
+	// how far leaf frames may reach below the lowest ESP at a call
+	stackLeafSlack = strtoul (optarg, NULL, 0);
+	break;
       case '?':
 	cerr << "option -" << optopt << "missing an argument.\n";
 	Usage (argVector[0]);	
@@ -294,19 +739,80 @@ main (int argCount, char **argVector)
       return 1;
     }
 
-  if (!traceData || !traceControl)
+  set<Address>::iterator iter;
+
+  // the graph holds all that is needed, the binary is not disassembled
+  if (graphMode)
     {
-      cerr << "could not find .trace.data and .trace.control in given path\n";
+      set<Address> &slice = GraphSlice (tracePath, thread, endCount);
+      cout << "{ ";
+      for (iter = slice.begin (); iter != slice.end (); iter++)
+	cout << (void *) (*iter) << " ";
+      cout << " }";
+      cout << endl; 
+      DiabloFrameworkEnd ();
+      return 0;
+    }
+
+  traceDataFile = tracePath + "/.trace.data" + threadSuffix;
+  traceControlFile = tracePath + "/.trace.control" + threadSuffix;
+  if (!traceData.Open (traceDataFile.c_str ()) 
+      || !traceControl.Open (traceControlFile.c_str ()))
+    {
+      cerr << "could not read .trace.data and .trace.control in given path\n";
       return 1;
     }
+  if (traceControl.Encoding () & TRACE_CONTROL_PATHS)
+    {
+      if (!pathTable.Load (pathTableFile.c_str ()))
+	{
+	  cerr << "could not read the .paths table of the path coded trace\n";
+	  return 1;
+	}
+      traceControl.Paths (&pathTable);
+    }
+
+  staticElided = traceData.HasFlag (TRACE_FLAG_STATIC_ELIDED);
+  framePointerKnown = traceData.HasFlag (TRACE_FLAG_FRAME_POINTER);
+  framePointer = traceData.FramePointer ();
+  stackPointerLogged = traceData.HasFlag (TRACE_FLAG_STACK_POINTER);
+  if (traceData.HasFlag (TRACE_FLAG_STACK_LIMIT))
+    stackLimit = traceData.StackLimit ();
+
+  if (endCount >= 0)
+    {
+      TraceIndex traceIndex;
+      TraceIndexEntry *entry;
+
+      traceIndexFile = tracePath + "/.trace.index" + threadSuffix;
+      if (!traceIndex.Open (traceIndexFile.c_str ()))
+	{
+	  cerr << "could not read .trace.index in given path\n";
+	  return 1;
+	}
+      // without an entry, slicing starts from the beginning, i.e. is empty
+      entry = traceIndex.Lookup (endCount);
+      traceControl.Seek (entry ? entry->controlOffset : 0);
+      traceData.Seek (entry ? entry->dataOffset : 0);
+      framePointer = entry ? entry->framePointer : 0;
+      framePointerKnown = entry != NULL;
+      if (entry)
+	cerr << "slicing from instruction " << entry->instructions << endl;
+    }
 
   Object object (argVector[optind]);
   object.DisAssemble ();
+  program = &object;
   iCFG = object.ICFG ();
   assert (iCFG != NULL);
+  IndexInstructions ();
 
   set<Address> &slice = DynamicSlice ();
-  set<Address>::iterator iter;
+
+  if (traceData.HasFlag (TRACE_FLAG_TRUNCATED))
+    cerr << "trace starts after instruction " 
+	 << traceData.FirstInstruction () 
+	 << ", older dependences are missing from the slice" << endl;
   
   cout << "{ ";
   for (iter = slice.begin (); iter != slice.end (); iter++)
@@ -0,0 +1,552 @@
+#include "tracereader.hxx"
+#include <string.h>
+#include <assert.h>
+using namespace std;
+
+// bytes fetched at once when walking a raw trace backwards
+#define WINDOW_SIZE (1 << 16)
+
+bool
+TraceFile::ReadAt (streamoff offset, char *buffer, size_t size)
+{
+  if (stored)
+    return store.Read (offset, buffer, size);
+  file.clear ();
+  file.seekg (offset, ios::beg);
+  file.read (buffer, size);
+  return !file.fail ();
+}
+
+bool
+TraceFile::Open (const char *path, uint32_t stream)
+{
+  stored = store.Open (path);
+  if (stored)
+    end = store.Size ();
+  else
+    {
+      file.open (path, ios::in | ios::binary);
+      if (!file)
+	return false;
+      file.seekg (0, ios::end);
+      end = file.tellg ();
+    }
+
+  // unversioned traces carry raw records from offset 0
+  begin = 0;
+  encoding = 0;
+  if (end >= (streamoff) sizeof (header) 
+      && ReadAt (0, (char *) &header, sizeof (header))
+      && header.magic == TRACE_MAGIC)
+    {
+      if (header.version != TRACE_VERSION || header.stream != stream)
+	return false;
+      begin = sizeof (header);
+      encoding = header.encoding;
+    }
+  else
+    memset (&header, 0, sizeof (header));
+  return true;
+}
+
+bool
+ControlTrace::Open (const char *path)
+{
+  if (!TraceFile::Open (path, TRACE_STREAM_CONTROL))
+    return false;
+  recordWords = encoding & TRACE_CONTROL_BLOCKS ? 2 : 1;
+  if ((encoding & TRACE_CONTROL_PATHS) && recordWords != 2)
+    return false;
+  return (encoding & ~(TRACE_CONTROL_BLOCKS | TRACE_CONTROL_REPEATS |
+		       TRACE_CONTROL_PATHS)) == 0;
+}
+
+//! @brief loads the repeat coded chunk ending at end & decodes its tokens
+bool
+ControlTrace::LoadChunk ()
+{
+  uint32_t tokenBytes;
+  vector<uint8_t> bytes;
+
+  if (end - begin < (streamoff) TRACE_REPEAT_TRAILER
+      || !ReadAt (end - TRACE_REPEAT_TRAILER, (char *) &tokenBytes,
+		  sizeof (tokenBytes)))
+    return false;
+  assert (end - begin >= tokenBytes + (streamoff) TRACE_REPEAT_TRAILER);
+  end -= tokenBytes + TRACE_REPEAT_TRAILER;
+  tokens.clear ();
+  if (tokenBytes == 0)
+    return true;
+  bytes.resize (tokenBytes);
+  if (!ReadAt (end, (char *) &bytes[0], tokenBytes))
+    return false;
+
+  const uint8_t *p = &bytes[0], *stop = p + tokenBytes;
+  uint32_t lastIp = 0;
+  while (p < stop)
+    {
+      Token token;
+      uint64_t value, count = 1;
+      p = TraceDecodeVarint (p, value);
+      token.ip = 0;
+      token.span = 0;
+      if (value & 1)
+	{
+	  token.span = value >> 1;
+	  assert (token.span != 0 && token.span <= tokens.size ());
+	  p = TraceDecodeVarint (p, count);
+	  assert (count != 0);
+	}
+      else
+	{
+	  token.ip = lastIp = lastIp + TraceUnzigzag ((uint32_t) (value >> 1));
+	  if (recordWords == 2)
+	    p = TraceDecodeVarint (p, count);
+	}
+      token.count = count;
+      tokens.push_back (token);
+    }
+  return true;
+}
+
+//! @brief Prev for repeat coded traces: walks the tokens of a chunk
+//         backwards, expanding each repeat met on the way
+bool
+ControlTrace::PrevRepeat (uint32_t &ip, uint32_t &count)
+{
+  for (;;)
+    {
+      if (frames.empty ())
+	{
+	  if (!LoadChunk ())
+	    return false;
+	  Frame chunk = { 0, tokens.size (), tokens.size (), 1 };
+	  frames.push_back (chunk);
+	}
+
+      Frame &frame = frames.back ();
+      if (frame.cur == frame.lo)
+	{
+	  if (--frame.remaining != 0)
+	    frame.cur = frame.hi;
+	  else
+	    frames.pop_back ();
+	  continue;
+	}
+
+      const Token &token = tokens[--frame.cur];
+      if (token.span == 0)
+	{
+	  ip = token.ip;
+	  count = token.count;
+	  return true;
+	}
+
+      // the extra copies come last; the original tokens are walked by the
+      // enclosing frame once they are done
+      Frame inner = { frame.cur - token.span, frame.cur, frame.cur, 
+		      token.count };
+      frames.push_back (inner);
+    }
+}
+
+//! @brief steps back to the previous record as logged
+bool
+ControlTrace::PrevRecord (uint32_t &ip, uint32_t &count)
+{
+  if (encoding & TRACE_CONTROL_REPEATS)
+    return PrevRepeat (ip, count);
+
+  if (cursor == 0)
+    {
+      streamoff size = min ((streamoff) WINDOW_SIZE, end - begin);
+      size -= size % (recordWords * sizeof (uint32_t));
+      if (size == 0)
+	return false;
+      window.resize (size / sizeof (uint32_t));
+      end -= size;
+      if (!ReadAt (end, (char *) &window[0], size))
+	return false;
+      cursor = window.size ();
+    }
+  cursor -= recordWords;
+  ip = window[cursor];
+  count = recordWords == 2 ? window[cursor + 1] : 1;
+  return true;
+}
+
+//! @brief pushes the execution of region id logged as value, after
+//         reading the records of its first & last child if it has them
+bool
+ControlTrace::ExpandRegion (uint32_t id, uint32_t value)
+{
+  Expansion e;
+  uint32_t ip, count, start = 0, last = PATH_NO_EXIT;
+
+  if (id == 0 || id >= paths->Regions ())
+    return false;
+  e.kind = Expansion::REGION;
+  e.ip = id;
+  e.count = 0;
+  e.ended = (value & TRACE_PATH_END) != 0;
+  e.remaining = 0;
+  if (e.ended)
+    {
+      if (!PrevRecord (ip, e.count))
+	return false;
+      last = paths->ChildIndex (id, ip);
+      if (last == PATH_NO_EXIT)
+	return false;
+    }
+  if (value & TRACE_PATH_START)
+    {
+      if (!PrevRecord (ip, count))
+	return false;
+      start = paths->ChildIndex (id, ip);
+      if (start == PATH_NO_EXIT)
+	return false;
+    }
+  if (!paths->Decode (id, start, last, value & TRACE_PATH_MASK, e.children))
+    return false;
+  e.cursor = e.children.size ();
+  expansions.push_back (e);
+  return true;
+}
+
+//! @brief Prev for path coded traces: expands the executions of regions
+//         into their children, last first, and the blocks ending in a
+//         call after the executions of the call. Events are returned as
+//         they are met.
+bool
+ControlTrace::PrevPath (uint32_t &ip, uint32_t &count)
+{
+  for (;;)
+    {
+      Expansion *e = expansions.empty () ? NULL : &expansions.back ();
+
+      if (e && e->kind == Expansion::BLOCK)
+	{
+	  ip = e->ip;
+	  count = e->count;
+	  expansions.pop_back ();
+	  return true;
+	}
+
+      if (e && e->kind == Expansion::REGION)
+	{
+	  if (e->cursor == 0)
+	    {
+	      expansions.pop_back ();
+	      continue;
+	    }
+	  uint32_t child = e->children[--e->cursor];
+	  bool last = e->ended && e->cursor + 1 == e->children.size ();
+	  uint32_t name = paths->Region (e->ip).children[child];
+	  uint32_t lastCount = e->count;
+	  Expansion next;
+
+	  next.ip = name;
+	  next.ended = false;
+	  next.cursor = 0;
+	  next.remaining = PATH_NO_EXIT;
+	  if (name < TRACE_PATH_REGIONS)
+	    {
+	      next.kind = Expansion::CHILD;
+	      next.count = 0;
+	      expansions.push_back (next);
+	      continue;
+	    }
+
+	  const PathBlock *block = paths->Block (name);
+	  if (block == NULL)
+	    return false;
+	  next.kind = Expansion::BLOCK;
+	  next.count = last ? lastCount & ~TRACE_PATH_CALLING : 
+	    block->instructions;
+	  if (next.count != 0)
+	    expansions.push_back (next);
+	  if (block->call && (!last || (lastCount & TRACE_PATH_CALLING)))
+	    {
+	      next.kind = Expansion::CALL;
+	      expansions.push_back (next);
+	    }
+	  continue;
+	}
+
+      if (e && e->kind == Expansion::CALL && e->remaining == 0)
+	{
+	  expansions.pop_back ();
+	  continue;
+	}
+
+      // the thread, a child or a call: the next record is theirs
+      if (!PrevRecord (ip, count))
+	return false;
+      if (ip >= TRACE_MARKER_BASE)
+	return true;
+      if (e == NULL)
+	{
+	  if (ip == TRACE_PATH_RETURN)
+	    continue;
+	  if (ip >= TRACE_PATH_REGIONS)
+	    return true;
+	}
+      else if (e->kind == Expansion::CHILD)
+	{
+	  if (ip != e->ip)
+	    return false;
+	  if (!(count & TRACE_PATH_REPEAT))
+	    expansions.pop_back ();
+	}
+      else if (e->remaining == PATH_NO_EXIT && ip == TRACE_PATH_RETURN)
+	{
+	  e->remaining = count;
+	  continue;
+	}
+      else
+	e->remaining = e->remaining == PATH_NO_EXIT ? 0 : e->remaining - 1;
+      if (!ExpandRegion (ip, count))
+	return false;
+    }
+}
+
+bool
+ControlTrace::Prev (uint32_t &ip, uint32_t &count)
+{
+  if (encoding & TRACE_CONTROL_PATHS)
+    return paths != NULL && PrevPath (ip, count);
+  return PrevRecord (ip, count);
+}
+
+bool
+DataTrace::Open (const char *path)
+{
+  if (!TraceFile::Open (path, TRACE_STREAM_DATA))
+    return false;
+  fcm.resize (TRACE_FCM_SIZE);
+  return encoding == TRACE_DATA_RAW || encoding == TRACE_DATA_COMPACT ||
+    encoding == TRACE_DATA_PREDICTED;
+}
+
+bool
+DataTrace::LoadRawWindow ()
+{
+  streamoff size = min ((streamoff) WINDOW_SIZE, end - begin);
+  size -= size % (2 * sizeof (uint32_t));
+  if (size == 0)
+    return false;
+  chunk.resize (size);
+  end -= size;
+  if (!ReadAt (end, (char *) &chunk[0], size))
+    return false;
+  records = &chunk[0];
+  cursor = records + size;
+  return true;
+}
+
+//! @brief loads the chunk ending at end and seeds the slot tables with
+//         its anchors
+bool
+DataTrace::LoadChunk ()
+{
+  uint32_t trailer[3];
+  
+  if (end - begin < (streamoff) TRACE_CHUNK_TRAILER
+      || !ReadAt (end - TRACE_CHUNK_TRAILER, (char *) trailer, 
+		  sizeof (trailer)))
+    return false;
+
+  streamoff size = (streamoff) trailer[1] + trailer[2];
+  assert (end - begin >= size + (streamoff) TRACE_CHUNK_TRAILER);
+  end -= size + TRACE_CHUNK_TRAILER;
+  chunk.resize (size);
+  if (size == 0 || !ReadAt (end, (char *) &chunk[0], size))
+    return false;
+
+  const uint8_t *p = &chunk[0] + trailer[1];
+  for (uint32_t i = 0; i < trailer[0]; i++)
+    {
+      uint64_t slot, anchorAddr, anchorSize;
+      p = TraceDecodeVarint (p, slot);
+      p = TraceDecodeVarint (p, anchorAddr);
+      p = TraceDecodeVarint (p, anchorSize);
+      lastAddr[slot] = nextAddr[slot] = anchorAddr;
+      lastSize[slot] = anchorSize;
+      runHits[slot] = 0;
+    }
+  fill (fcm.begin (), fcm.end (), 0);
+  records = &chunk[0];
+  cursor = records + trailer[1];
+  return true;
+}
+
+bool
+DataTrace::Prev (unsigned &addr, unsigned &size)
+{
+  assert (k > 0);
+  k--;
+  if (cursor == records)
+    {
+      bool loaded = encoding == TRACE_DATA_RAW ? 
+	LoadRawWindow () : LoadChunk ();
+      if (!loaded || cursor == records)
+	return false;
+    }
+
+  if (encoding == TRACE_DATA_RAW)
+    {
+      cursor -= 2 * sizeof (uint32_t);
+      memcpy (&addr, cursor, sizeof (uint32_t));
+      memcpy (&size, cursor + sizeof (uint32_t), sizeof (uint32_t));
+      return true;
+    }
+
+  // the slot holds this access; step it back to the previous one
+  unsigned slot = TraceSlot (ip, k);
+  uint64_t value, prevSize;
+  
+  addr = lastAddr[slot];
+  size = lastSize[slot];
+  if (encoding == TRACE_DATA_PREDICTED)
+    {
+      PrevPredicted (slot);
+      return true;
+    }
+  cursor = TraceDecodeVarintBefore (records, cursor, value);
+  lastAddr[slot] = addr - TraceUnzigzag ((uint32_t) (value >> 2));
+  if ((value & 3) == TRACE_TAG_RESIZE)
+    {
+      cursor = TraceDecodeVarintBefore (records, cursor, prevSize);
+      lastSize[slot] = prevSize;
+    }
+  return true;
+}
+
+//! @brief steps the slot back to the access before its last one, from a
+//         pending hit or the next record, see "Predicted Data Encoding"
+void
+DataTrace::PrevPredicted (unsigned slot)
+{
+  uint32_t next1 = lastAddr[slot], next2 = nextAddr[slot];
+  uint32_t &context = fcm[TraceFcmIndex (slot, next1, next2)];
+  uint64_t value, prevSize;
+  uint32_t prev;
+
+  if (runHits[slot] != 0)
+    {
+      runHits[slot]--;
+      value = runKind[slot];
+    }
+  else
+    {
+      cursor = TraceDecodeVarintBefore (records, cursor, value);
+      if ((value & 3) <= TRACE_PRED_FCM)
+	{
+	  runHits[slot] = value >> 2;
+	  runKind[slot] = value & 3;
+	}
+    }
+
+  switch (value & 3)
+    {
+    case TRACE_PRED_STRIDE:
+      prev = TraceStride (next1, next2);
+      break;
+    case TRACE_PRED_FCM:
+      prev = context;
+      break;
+    default:
+      prev = next1 - TraceUnzigzag ((uint32_t) (value >> 2));
+      if ((value & 3) == TRACE_PRED_RESIZE)
+	{
+	  cursor = TraceDecodeVarintBefore (records, cursor, prevSize);
+	  lastSize[slot] = prevSize;
+	}
+    }
+
+  context = prev;
+  nextAddr[slot] = next1;
+  lastAddr[slot] = prev;
+}
+
+bool
+TraceIndex::Open (const char *path)
+{
+  if (!TraceFile::Open (path, TRACE_STREAM_INDEX) || begin == 0)
+    return false;
+  entries.resize ((end - begin) / sizeof (TraceIndexEntry));
+  return entries.empty () || 
+    ReadAt (begin, (char *) &entries[0], 
+	    entries.size () * sizeof (TraceIndexEntry));
+}
+
+TraceIndexEntry *
+TraceIndex::Lookup (uint64_t instructions)
+{
+  TraceIndexEntry *found = NULL;
+
+  // entries are sorted by instruction count
+  for (size_t i = 0; i < entries.size (); i++)
+    {
+      if (entries[i].instructions > instructions)
+	break;
+      found = &entries[i];
+    }
+  return found;
+}
+
+bool
+DepGraph::Open (const char *path)
+{
+  if (!TraceFile::Open (path, TRACE_STREAM_DEPS) || begin == 0)
+    return false;
+
+  vector<uint8_t> bytes (end - begin);
+  if (!bytes.empty () && !ReadAt (begin, (char *) &bytes[0], bytes.size ()))
+    return false;
+
+  // deps of the last record of every slot, as encoded
+  vector<vector<uint64_t> > slotWords (TRACE_SLOTS);
+  vector<uint64_t> words;
+  const uint8_t *p = bytes.empty () ? NULL : &bytes[0];
+  const uint8_t *last = p + bytes.size ();
+  uint32_t ip = 0;
+
+  firstDep.push_back (0);
+  while (p < last)
+    {
+      uint64_t v, count;
+      uint64_t n = ips.size ();
+
+      p = TraceDecodeVarint (p, v);
+      ip += TraceUnzigzag ((uint32_t) (v >> 1));
+      vector<uint64_t> &slot = slotWords[TraceSlot (ip, 0)];
+      if (!(v & 1))
+	{
+	  p = TraceDecodeVarint (p, count);
+	  words.resize (count);
+	  for (uint64_t i = 0; i < count; i++)
+	    p = TraceDecodeVarint (p, words[i]);
+	  slot.swap (words);
+	}
+
+      for (size_t i = 0; i < slot.size (); i++)
+	{
+	  DepRef dep;
+	  if (slot[i] & 1)
+	    {
+	      dep.thread = slot[i] >> 1;
+	      dep.node = slot[++i];
+	    }
+	  else
+	    {
+	      dep.thread = header.thread;
+	      dep.node = n - (slot[i] >> 1);
+	    }
+	  deps.push_back (dep);
+	}
+      ips.push_back (ip);
+      firstDep.push_back (deps.size ());
+    }
+  return true;
+}
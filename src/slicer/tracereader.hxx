@@ -0,0 +1,178 @@
+/*! @file
+ *  tracereader : backward readers for the control & data traces written
+ *  by the naive tracer, and a reader of its dependence graph. The raw,
+ *  compact & predicted data encodings are handled, as well as unversioned
+ *  traces without a header, and traces kept as manifests of a tracestore.
+ */
+
+#ifndef __TRACEREADER_HXX
+#define __TRACEREADER_HXX
+
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include "traceformat.hxx"
+#include "pathtable.hxx"
+#include "tracestore.hxx"
+
+//! @class trace file read from its end towards its header
+class TraceFile
+{
+protected:
+  std::ifstream file;
+  TraceStoreReader store;       // for manifests
+  bool stored;
+  std::streamoff begin;         // first byte after the header
+  std::streamoff end;           // first byte not consumed yet
+  uint32_t encoding;
+  TraceHeader header;           // zeroed for unversioned traces
+
+  bool ReadAt (std::streamoff offset, char *buffer, size_t size);
+public:
+  TraceFile () : stored (false), begin (0), end (0), encoding (0) {}
+  bool Open (const char *path, uint32_t stream);
+  uint32_t Encoding () { return encoding; }
+  bool HasFlag (uint32_t flag) { return (header.flags & flag) != 0; }
+  uint32_t FramePointer () { return header.framePointer; }
+  uint32_t StackLimit () { return header.stackLimit; }
+  uint64_t FirstInstruction () { return header.firstInstruction; }
+};
+
+//! @class .trace.control, one record per executed instruction or block
+class ControlTrace: public TraceFile
+{
+  std::vector<uint32_t> window;
+  size_t cursor;
+  size_t recordWords;
+
+  //! @brief token of a repeat coded chunk: a record, or a repeat of the
+  //         span tokens before it, count more times
+  struct Token
+  {
+    uint32_t ip;
+    uint32_t count;
+    uint32_t span;              // 0 for a record
+  };
+
+  //! @brief repeat being expanded: tokens [lo, hi) are walked backwards
+  //         from cur, remaining more times including this one
+  struct Frame
+  {
+    size_t lo;
+    size_t hi;
+    size_t cur;
+    uint64_t remaining;
+  };
+
+  std::vector<Token> tokens;
+  std::vector<Frame> frames;    // innermost repeat last
+
+  //! @brief path coded traces: what is left to walk of an execution of a
+  //         region, of the region executions logged for a child of its
+  //         region or for a call, or a block to be returned once the
+  //         records of its call are walked
+  struct Expansion
+  {
+    enum { REGION, CHILD, CALL, BLOCK } kind;
+    uint32_t ip;                // region id, or block address
+    uint32_t count;             // instructions of a block, or the count
+                                // of the last child of a region
+    bool ended;                 // in the last child, before an exit
+    std::vector<uint32_t> children;
+    size_t cursor;              // children not walked yet
+    uint32_t remaining;         // records of a call, PATH_NO_EXIT if not
+                                // known yet
+  };
+
+  PathTable *paths;
+  std::vector<Expansion> expansions;    // innermost last
+
+  bool LoadChunk ();
+  bool PrevRepeat (uint32_t &ip, uint32_t &count);
+  bool PrevRecord (uint32_t &ip, uint32_t &count);
+  bool ExpandRegion (uint32_t id, uint32_t value);
+  bool PrevPath (uint32_t &ip, uint32_t &count);
+public:
+  ControlTrace () : cursor (0), recordWords (1), paths (NULL) {}
+  bool Open (const char *path);
+  //! @brief sets the table a path coded trace is decoded with
+  void Paths (PathTable *table) { paths = table; }
+  //! @brief steps back to the previous block, of a single instruction
+  //         in raw traces
+  bool Prev (uint32_t &ip, uint32_t &count);
+  //! @brief restarts reading backwards from offset, e.g. of an index entry
+  void Seek (std::streamoff offset) 
+  { 
+    end = std::max (offset, begin); cursor = 0; frames.clear (); 
+    expansions.clear ();
+  }
+};
+
+//! @class .trace.data, one (address, size) record per traced memory access.
+//         Records of an instruction are announced with Instruction () and
+//         then popped with Prev (), last record first.
+class DataTrace: public TraceFile
+{
+  std::vector<uint8_t> chunk;
+  const uint8_t *records;      // start of the records of the current chunk
+  const uint8_t *cursor;       // end of the records not consumed yet
+  uint32_t lastAddr[TRACE_SLOTS];
+  uint32_t lastSize[TRACE_SLOTS];
+  uint32_t ip;
+  unsigned k;
+
+  // predicted encoding: the access after the last one per slot, pending
+  // hits of the last hit record per slot & the context table
+  uint32_t nextAddr[TRACE_SLOTS];
+  uint64_t runHits[TRACE_SLOTS];
+  uint8_t runKind[TRACE_SLOTS];
+  std::vector<uint32_t> fcm;
+
+  bool LoadRawWindow ();
+  bool LoadChunk ();
+  void PrevPredicted (unsigned slot);
+public:
+  DataTrace () : records (NULL), cursor (NULL), ip (0), k (0) {}
+  bool Open (const char *path);
+  void Instruction (uint32_t addr, unsigned count) { ip = addr; k = count; }
+  bool Prev (unsigned &addr, unsigned &size);
+  void Seek (std::streamoff offset) 
+  { end = std::max (offset, begin); records = cursor = NULL; }
+};
+
+//! @class .trace.index, read at once
+class TraceIndex: public TraceFile
+{
+  std::vector<TraceIndexEntry> entries;
+public:
+  bool Open (const char *path);
+  //! @return last entry at or before the given instruction count, NULL if
+  //          there is none
+  TraceIndexEntry *Lookup (uint64_t instructions);
+};
+
+//! @brief node of a dependence graph
+struct DepRef
+{
+  uint32_t thread;
+  uint64_t node;
+};
+
+//! @class .trace.deps of one thread, read at once
+class DepGraph: public TraceFile
+{
+  std::vector<uint32_t> ips;
+  std::vector<uint64_t> firstDep;   // per node, and one past the last
+  std::vector<DepRef> deps;
+public:
+  bool Open (const char *path);
+  uint64_t Nodes () { return ips.size (); }
+  uint32_t Ip (uint64_t n) { return ips[n]; }
+  //! @brief the deps of node n are Dep (i) for i in [DepsBegin (n), 
+  //         DepsBegin (n + 1))
+  uint64_t DepsBegin (uint64_t n) { return firstDep[n]; }
+  const DepRef &Dep (uint64_t i) { return deps[i]; }
+};
+
+#endif
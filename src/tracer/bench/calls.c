@@ -0,0 +1,23 @@
+/* calls : many short calls through a function pointer table */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static int add (int x, int y) { return x + y; }
+static int sub (int x, int y) { return x - y; }
+static int mix (int x, int y) { return (x ^ y) + (x & y); }
+static int shift (int x, int y) { return x << (y & 7); }
+
+static int (*ops[4]) (int, int) = { add, sub, mix, shift };
+
+int
+main (int argc, char **argv)
+{
+  int scale = argc > 1 ? atoi (argv[1]) : 1;
+  int i, acc = 1;
+
+  for (i = 0; i < (1 << 20) * scale; i++)
+    acc = ops[i & 3] (acc, i);
+  printf ("%d\n", acc);
+  return 0;
+}
@@ -0,0 +1,48 @@
+/* chase : pointer chasing through a randomly linked list, one dependent
+   load per step */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+struct node
+{
+  struct node *next;
+  int value;
+};
+
+int
+main (int argc, char **argv)
+{
+  int scale = argc > 1 ? atoi (argv[1]) : 1;
+  int n = 1 << 16;
+  struct node *nodes = malloc (n * sizeof (struct node));
+  int *order = malloc (n * sizeof (int));
+  struct node *p;
+  int i;
+  unsigned sum = 0;
+
+  for (i = 0; i < n; i++)
+    order[i] = i;
+  srand (1);
+  for (i = n - 1; i > 0; i--)
+    {
+      int j = rand () % (i + 1);
+      int tmp = order[i];
+      order[i] = order[j];
+      order[j] = tmp;
+    }
+  for (i = 0; i < n; i++)
+    {
+      nodes[order[i]].next = &nodes[order[(i + 1) % n]];
+      nodes[order[i]].value = i;
+    }
+
+  p = &nodes[order[0]];
+  for (i = 0; i < 16 * n * scale; i++)
+    {
+      sum += p->value;
+      p = p->next;
+    }
+  printf ("%u\n", sum);
+  return 0;
+}
@@ -0,0 +1,26 @@
+/* recurse : deep recursion, frame setup & teardown on every call */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static int
+ackermann (int m, int n)
+{
+  if (m == 0)
+    return n + 1;
+  if (n == 0)
+    return ackermann (m - 1, 1);
+  return ackermann (m - 1, ackermann (m, n - 1));
+}
+
+int
+main (int argc, char **argv)
+{
+  int scale = argc > 1 ? atoi (argv[1]) : 1;
+  int i, sum = 0;
+
+  for (i = 0; i < 4 * scale; i++)
+    sum += ackermann (2, 500 + i);
+  printf ("%d\n", sum);
+  return 0;
+}
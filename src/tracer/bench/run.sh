@@ -0,0 +1,73 @@
+#!/bin/sh
+# run.sh : runs each benchmark kernel natively and under each tracer mode,
+# and reports the slowdown, the instructions traced per second and the
+# trace bytes per instruction.
+#
+# usage: run.sh "<pin command>" <tool directory> <kernel>...
+#
+# The kernels take a scale factor, BENCH_SCALE (default 1). Modes are
+# read from BENCH_MODES, one "<tool> <knobs>" per line. Tools are named
+# without PINTOOL_SUFFIX, .so for the kits of makefile.gnu.config.
+
+PIN="$1"
+TOOLS=`cd "$2" && pwd`
+shift 2
+
+SCALE=${BENCH_SCALE:-1}
+MODES=${BENCH_MODES:-"tracer.naive
+tracer.naive -control bbl
+tracer.naive -repeats 0
+tracer.naive -predict 0
+tracer.naive -compact 0 -elide 0
+tracer.naive -sink stream
+tracer.naive -deps 1
+tracer.naive -record 1
+tracer"}
+
+WORK=`mktemp -d`
+trap 'rm -rf "$WORK"' EXIT
+
+now ()
+{
+  date +%s%N
+}
+
+# instructions executed under a tool, from its own report
+instructions ()
+{
+  if [ -f .stats ]; then
+    sed -n 's/^# Instructions = //p' .stats
+  else
+    sed -n 's/^Instruction Count = //p' stderr
+  fi
+}
+
+printf "%-10s %-36s %10s %10s %14s %10s\n" \
+  kernel mode seconds slowdown "ins/s" "bytes/ins"
+
+for kernel in "$@"; do
+  binary=`cd \`dirname "$kernel"\` && pwd`/`basename "$kernel"`
+  name=`basename "$kernel"`
+
+  start=`now`
+  "$binary" $SCALE > /dev/null
+  native=$(( `now` - start ))
+  printf "%-10s %-36s %10s\n" $name native \
+    `awk "BEGIN { printf \"%.3f\", $native / 1e9 }"`
+
+  echo "$MODES" | while read tool knobs; do
+    rm -rf "$WORK"/* "$WORK"/.[!.]*
+    cd "$WORK"
+    start=`now`
+    $PIN -t "$TOOLS/$tool$PINTOOL_SUFFIX" $knobs -- "$binary" $SCALE > /dev/null 2> stderr
+    traced=$(( `now` - start ))
+    ins=`instructions`
+    bytes=`cat .trace* 2> /dev/null | wc -c`
+    cd - > /dev/null
+
+    awk -v name=$name -v mode="$tool $knobs" -v t=$traced -v n=$native \
+        -v ins=${ins:-0} -v bytes=$bytes 'BEGIN {
+      printf "%-10s %-36s %10.3f %10.1f %14.0f %10.2f\n", name, mode,
+        t / 1e9, t / n, ins / (t / 1e9), ins ? bytes / ins : 0 }'
+  done
+done
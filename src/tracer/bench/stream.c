@@ -0,0 +1,29 @@
+/* stream : sequential array updates, the STREAM triad */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define N (1 << 16)
+
+static int a[N], b[N], c[N];
+
+int
+main (int argc, char **argv)
+{
+  int scale = argc > 1 ? atoi (argv[1]) : 1;
+  int i, k;
+  unsigned sum = 0;
+
+  for (i = 0; i < N; i++)
+    {
+      b[i] = i;
+      c[i] = N - i;
+    }
+  for (k = 0; k < 16 * scale; k++)
+    for (i = 0; i < N; i++)
+      a[i] = b[i] + 3 * c[i] + k;
+  for (i = 0; i < N; i++)
+    sum += a[i];
+  printf ("%u\n", sum);
+  return 0;
+}
@@ -0,0 +1,26 @@
+/* strings : libc string operations, rep-prefixed & byte-wise accesses */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LENGTH 4096
+
+int
+main (int argc, char **argv)
+{
+  int scale = argc > 1 ? atoi (argv[1]) : 1;
+  static char src[LENGTH], dst[LENGTH];
+  int i;
+  unsigned sum = 0;
+
+  memset (src, 'a', LENGTH - 1);
+  for (i = 0; i < 1024 * scale; i++)
+    {
+      src[i % (LENGTH - 1)] = 'a' + i % 26;
+      memcpy (dst, src, LENGTH);
+      sum += strlen (dst) + (strchr (dst, 'z') - dst) + strcmp (dst, src);
+    }
+  printf ("%u\n", sum);
+  return 0;
+}
@@ -0,0 +1,672 @@
+/*! @file
+ *  replaylog : record & replay modes of the naive tracer. Recording logs
+ *  only what re-execution cannot reproduce, see "Replay Log" in
+ *  traceformat.hxx, at little more than the cost of running under Pin.
+ *  Replaying re-executes the program with the recorded system call
+ *  results, signals, rdtsc & cpuid values while the tracer writes the
+ *  full traces, for the window selected by -start_after & -stop_after.
+ *
+ *  Replay assumes the same binary, arguments, environment & address
+ *  space layout as the recording, e.g. both run under setarch -R. Input
+ *  read by system calls is replayed; system calls that shape the process,
+ *  such as open, mmap or clone, are executed anew and, for some, checked
+ *  against the log. Asynchronous signals are logged with the position of
+ *  the thread they interrupted, by the branches it ran, its IP & ECX, and
+ *  raised at the same position on replay. The interleaving of threads and
+ *  time read through the vDSO are not recorded. A thread whose replay
+ *  departs from its log, or gets a signal elsewhere, is reported and runs
+ *  on natively.
+ */
+
+#ifndef __REPLAYLOG_HXX
+#define __REPLAYLOG_HXX
+
+#include "pin.H"
+#include "traceformat.hxx"
+#include "tracesink.hxx"
+#include <stdio.h>
+#include <signal.h>
+#include <string.h>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+extern "C"
+{
+#include <unistd.h>
+#include <sys/syscall.h>
+}
+
+#define REPLAY_MAX_THREADS 64
+
+//! @brief handling of a system call on replay
+enum
+{
+  // executed anew
+  REPLAY_EXECUTE,
+  // executed anew, and its result checked against the log
+  REPLAY_CHECK,
+  // skipped, its recorded result & the memory the kernel wrote restored
+  REPLAY_EMULATE
+};
+
+//! @brief system call of the i386 kernel handled other than by execution,
+//         with the argument pointing to its output, if any, and the size
+//         of the output, 0 for as many bytes as the result
+struct ReplaySyscall
+{
+  UINT32 number;
+  UINT32 action;
+  INT32 output;
+  UINT32 size;
+};
+
+static const ReplaySyscall replaySyscalls[] =
+{
+  { 3, REPLAY_EMULATE, 1, 0 },          // read
+  { 4, REPLAY_EMULATE, -1, 0 },         // write
+  { 5, REPLAY_CHECK, -1, 0 },           // open
+  { 13, REPLAY_EMULATE, 0, 4 },         // time
+  { 19, REPLAY_EMULATE, -1, 0 },        // lseek
+  { 27, REPLAY_EMULATE, -1, 0 },        // alarm
+  { 43, REPLAY_EMULATE, 0, 16 },        // times
+  { 45, REPLAY_CHECK, -1, 0 },          // brk
+  { 78, REPLAY_EMULATE, 0, 8 },         // gettimeofday
+  { 85, REPLAY_EMULATE, 1, 0 },         // readlink
+  { 90, REPLAY_CHECK, -1, 0 },          // mmap
+  { 104, REPLAY_EMULATE, 2, 16 },       // setitimer
+  { 106, REPLAY_EMULATE, 1, 64 },       // stat
+  { 107, REPLAY_EMULATE, 1, 64 },       // lstat
+  { 108, REPLAY_EMULATE, 1, 64 },       // fstat
+  { 122, REPLAY_EMULATE, 0, 390 },      // uname
+  { 140, REPLAY_EMULATE, 3, 8 },        // _llseek
+  { 141, REPLAY_EMULATE, 1, 0 },        // getdents
+  { 146, REPLAY_EMULATE, -1, 0 },       // writev
+  { 163, REPLAY_CHECK, -1, 0 },         // mremap
+  { 180, REPLAY_EMULATE, 1, 0 },        // pread64
+  { 183, REPLAY_EMULATE, 0, 0 },        // getcwd
+  { 192, REPLAY_CHECK, -1, 0 },         // mmap2
+  { 195, REPLAY_EMULATE, 1, 96 },       // stat64
+  { 196, REPLAY_EMULATE, 1, 96 },       // lstat64
+  { 197, REPLAY_EMULATE, 1, 96 },       // fstat64
+  { 220, REPLAY_EMULATE, 1, 0 },        // getdents64
+  { 265, REPLAY_EMULATE, 1, 8 },        // clock_gettime
+  { 300, REPLAY_EMULATE, 2, 96 },       // fstatat64
+  { 355, REPLAY_EMULATE, 0, 0 }         // getrandom
+};
+
+// system call an emulated one is turned into: getpid, which has no effect
+#define REPLAY_NOP_SYSCALL 20
+
+//! @return true for kill, tkill & tgkill, whose signals are raised anew
+static BOOL
+ReplaySendsSignal (UINT32 number)
+{
+  return number == 37 || number == 238 || number == 270;
+}
+
+//! @return true for signals raised by the faulting instruction itself,
+//          which re-execution reproduces
+static BOOL
+ReplayIsSynchronous (INT32 sig)
+{
+  return sig == SIGSEGV || sig == SIGBUS || sig == SIGILL ||
+    sig == SIGFPE || sig == SIGTRAP;
+}
+
+struct ReplayThread
+{
+  // system calls completed so far
+  UINT64 syscalls;
+
+  // system call in progress
+  BOOL inSyscall;
+  UINT32 number;
+  ADDRINT args[6];
+  const ReplaySyscall *spec;
+
+  // record mode: log being written
+  TraceSink *file;
+
+  // replay mode: log being read, its record of the system call in
+  // progress with its extents, and the record after it, if read ahead
+  FILE *log;
+  TraceReplayRecord record;
+  std::vector<UINT8> extents;
+  BOOL peeked;
+  TraceReplayRecord next;
+  BOOL diverged;
+};
+
+//! @brief position of a thread, by the branches, calls & returns it ran,
+//         and on replay the position of the next signal of its log, IP 0
+//         if none is due. Kept apart from ReplayThread so that the
+//         analysis code of every branch stays inlined.
+struct ReplayPosition
+{
+  UINT64 instructions;          // record mode only
+  UINT64 branches;
+  UINT64 dueBranches;
+  ADDRINT dueIp;
+  ADDRINT dueEcx;
+  // keeps the positions of two threads off the same cache line
+  UINT8 pad[64];
+};
+
+static ReplayThread *replayThreads[REPLAY_MAX_THREADS];
+static ReplayPosition replayPositions[REPLAY_MAX_THREADS];
+static BOOL replaying;
+static std::string replaySink;
+static std::string replayDirectory;
+
+//! @return name of the replay log of a thread
+static std::string
+ReplayLogName (THREADID tid)
+{
+  std::stringstream name;
+
+  name << ".trace.replay";
+  if (tid != 0)
+    name << "." << tid;
+  return name.str ();
+}
+
+static const ReplaySyscall *
+FindReplaySyscall (UINT32 number)
+{
+  for (UINT32 i = 0; i < sizeof (replaySyscalls) / sizeof (replaySyscalls[0]);
+       i++)
+    if (replaySyscalls[i].number == number)
+      return &replaySyscalls[i];
+  return NULL;
+}
+
+static VOID
+ReplayCountBranch (THREADID tid)
+{
+  replayPositions[tid].branches++;
+}
+
+static VOID
+ReplayCountInstructions (THREADID tid, UINT32 count)
+{
+  replayPositions[tid].instructions += count;
+}
+
+/* ===================================================================== */
+/* Record */
+/* ===================================================================== */
+
+static VOID
+RecordReplaySyscallEntry (THREADID tid, CONTEXT *ctxt, SYSCALL_STANDARD std,
+			  VOID *v)
+{
+  ReplayThread *t = replayThreads[tid];
+
+  t->inSyscall = true;
+  t->number = PIN_GetSyscallNumber (ctxt, std);
+  for (UINT32 i = 0; i < 6; i++)
+    t->args[i] = PIN_GetSyscallArgument (ctxt, std, i);
+}
+
+//! @brief logs a system call with the output of an emulated one
+static VOID
+RecordReplaySyscallExit (THREADID tid, CONTEXT *ctxt, SYSCALL_STANDARD std,
+			 VOID *v)
+{
+  ReplayThread *t = replayThreads[tid];
+  const ReplaySyscall *spec = FindReplaySyscall (t->number);
+  ADDRINT result = PIN_GetSyscallReturn (ctxt, std);
+  TraceReplayRecord record;
+  std::vector<UINT8> extents;
+
+  if (!t->inSyscall)
+    return;
+  t->inSyscall = false;
+
+  memset (&record, 0, sizeof (record));
+  record.kind = TRACE_REPLAY_SYSCALL;
+  record.number = t->number;
+  record.result = result;
+  record.syscalls = t->syscalls++;
+
+  // errors are results from -4095 to -1, with no output
+  if (spec && spec->action == REPLAY_EMULATE && spec->output >= 0 &&
+      t->args[spec->output] != 0 && result < (ADDRINT) -4095)
+    {
+      UINT32 extent[2];
+      extent[0] = t->args[spec->output];
+      extent[1] = spec->size ? spec->size : result;
+      extents.resize (sizeof (extent) + extent[1]);
+      memcpy (&extents[0], extent, sizeof (extent));
+      if (extent[1])
+	PIN_SafeCopy (&extents[sizeof (extent)], (VOID *) (ADDRINT) extent[0],
+		      extent[1]);
+      record.extents = 1;
+    }
+
+  t->file->Write (&record, sizeof (record));
+  if (!extents.empty ())
+    t->file->Write (&extents[0], extents.size ());
+}
+
+static VOID
+RecordReplayValues (THREADID tid, UINT32 kind, ADDRINT eax, ADDRINT ebx,
+		    ADDRINT ecx, ADDRINT edx)
+{
+  ReplayThread *t = replayThreads[tid];
+  TraceReplayRecord record;
+
+  memset (&record, 0, sizeof (record));
+  record.kind = kind;
+  record.syscalls = t->syscalls;
+  record.values[0] = eax;
+  record.values[1] = ebx;
+  record.values[2] = ecx;
+  record.values[3] = edx;
+  t->file->Write (&record, sizeof (record));
+}
+
+/* ===================================================================== */
+/* Replay */
+/* ===================================================================== */
+
+//! @brief stops replaying a thread that departed from its log
+static VOID
+ReplayDiverge (THREADID tid, const char *what)
+{
+  ReplayThread *t = replayThreads[tid];
+
+  if (t->diverged)
+    return;
+  std::cerr << "replay of thread " << tid << " diverged after system call "
+	    << t->syscalls << ": " << what << ", running on natively"
+	    << std::endl;
+  t->diverged = true;
+}
+
+//! @return next record of the log, false at its end
+static BOOL
+PeekReplayRecord (ReplayThread *t, TraceReplayRecord **record)
+{
+  if (!t->peeked)
+    t->peeked = fread (&t->next, sizeof (t->next), 1, t->log) == 1;
+  *record = &t->next;
+  return t->peeked;
+}
+
+//! @brief reads the next record of the log & its extents
+//  @return false at the end of the log
+static BOOL
+NextReplayRecord (ReplayThread *t, TraceReplayRecord *record)
+{
+  TraceReplayRecord *next;
+
+  if (!PeekReplayRecord (t, &next))
+    return false;
+  *record = *next;
+  t->peeked = false;
+
+  t->extents.clear ();
+  for (UINT32 i = 0; i < record->extents; i++)
+    {
+      UINT32 extent[2];
+      size_t at = t->extents.size ();
+
+      if (fread (extent, sizeof (extent), 1, t->log) != 1)
+	return false;
+      t->extents.resize (at + sizeof (extent) + extent[1]);
+      memcpy (&t->extents[at], extent, sizeof (extent));
+      if (extent[1] &&
+	  fread (&t->extents[at + sizeof (extent)], extent[1], 1, t->log) != 1)
+	return false;
+    }
+  return true;
+}
+
+//! @brief arms the signal the log holds next, if any, to be raised at its
+//         position, see ReplayIsDue
+static VOID
+ArmDueSignal (THREADID tid)
+{
+  ReplayThread *t = replayThreads[tid];
+  ReplayPosition *p = &replayPositions[tid];
+  TraceReplayRecord *next;
+
+  p->dueIp = 0;
+  if (t->diverged || !PeekReplayRecord (t, &next) ||
+      next->kind != TRACE_REPLAY_SIGNAL)
+    return;
+  p->dueBranches = next->values[0] | (UINT64) next->values[1] << 32;
+  p->dueEcx = next->values[3];
+  p->dueIp = next->values[2];
+}
+
+static ADDRINT
+ReplayIsDue (THREADID tid, ADDRINT ip, ADDRINT ecx)
+{
+  ReplayPosition *p = &replayPositions[tid];
+
+  return (p->dueIp == ip) & (p->branches == p->dueBranches) &
+    (p->dueEcx == ecx);
+}
+
+//! @brief raises the signal due at this instruction, and has Pin deliver
+//         it by re-entering the instruction, ahead of its analysis code
+static VOID
+ReplayRaiseSignal (THREADID tid, CONTEXT *ctxt)
+{
+  TraceReplayRecord *next;
+
+  replayPositions[tid].dueIp = 0;
+  PeekReplayRecord (replayThreads[tid], &next);
+  syscall (SYS_tgkill, PIN_GetPid (), PIN_GetTid (), next->number);
+  PIN_ExecuteAt (ctxt);
+}
+
+//! @brief checks a system call against the log, and turns one to be
+//         emulated into a call without effect
+static VOID
+ReplaySyscallEntry (THREADID tid, CONTEXT *ctxt, SYSCALL_STANDARD std,
+		    VOID *v)
+{
+  ReplayThread *t = replayThreads[tid];
+
+  if (t->diverged)
+    return;
+  t->inSyscall = true;
+  t->number = PIN_GetSyscallNumber (ctxt, std);
+  t->spec = FindReplaySyscall (t->number);
+  if (!NextReplayRecord (t, &t->record))
+    {
+      ReplayDiverge (tid, "end of the log");
+      return;
+    }
+  if (t->record.kind != TRACE_REPLAY_SYSCALL ||
+      t->record.number != t->number)
+    {
+      ReplayDiverge (tid, "another system call was recorded");
+      return;
+    }
+  if (t->spec && t->spec->action == REPLAY_EMULATE)
+    PIN_SetSyscallNumber (ctxt, std, REPLAY_NOP_SYSCALL);
+}
+
+static VOID
+ReplaySyscallExit (THREADID tid, CONTEXT *ctxt, SYSCALL_STANDARD std,
+		   VOID *v)
+{
+  ReplayThread *t = replayThreads[tid];
+
+  if (t->diverged || !t->inSyscall)
+    return;
+  t->inSyscall = false;
+  t->syscalls++;
+
+  if (t->spec && t->spec->action == REPLAY_EMULATE)
+    {
+      for (size_t at = 0; at < t->extents.size (); )
+	{
+	  UINT32 *extent = (UINT32 *) &t->extents[at];
+	  PIN_SafeCopy ((VOID *) (ADDRINT) extent[0], extent + 2, extent[1]);
+	  at += 2 * sizeof (UINT32) + extent[1];
+	}
+      PIN_SetContextReg (ctxt, REG_EAX, t->record.result);
+    }
+  else if (t->spec && t->spec->action == REPLAY_CHECK &&
+	   PIN_GetSyscallReturn (ctxt, std) != t->record.result)
+    ReplayDiverge (tid, "another result was recorded");
+
+  // the signals the program sends itself come anew, and are checked
+  // against the log as others
+  ArmDueSignal (tid);
+  if (ReplaySendsSignal (t->number))
+    replayPositions[tid].dueIp = 0;
+}
+
+static VOID
+ReplayValues (THREADID tid, UINT32 kind, ADDRINT *eax, ADDRINT *ebx,
+	      ADDRINT *ecx, ADDRINT *edx)
+{
+  ReplayThread *t = replayThreads[tid];
+  TraceReplayRecord record;
+
+  if (t->diverged)
+    return;
+  if (!NextReplayRecord (t, &record) || record.kind != kind)
+    {
+      ReplayDiverge (tid, kind == TRACE_REPLAY_RDTSC ?
+		     "rdtsc was not recorded" : "cpuid was not recorded");
+      return;
+    }
+  *eax = record.values[0];
+  *edx = record.values[3];
+  if (kind == TRACE_REPLAY_CPUID)
+    {
+      *ebx = record.values[1];
+      *ecx = record.values[2];
+    }
+  ArmDueSignal (tid);
+}
+
+/* ===================================================================== */
+
+VOID ReplayInstrument (INS ins, VOID *v)
+{
+  UINT32 kind;
+
+  // a signal due is raised ahead of all analysis code of the instruction,
+  // which then runs once, after the handler
+  if (replaying)
+    {
+      INS_InsertIfCall (ins, IPOINT_BEFORE, (AFUNPTR) ReplayIsDue,
+			IARG_CALL_ORDER, CALL_ORDER_FIRST,
+			IARG_THREAD_ID,
+			IARG_INST_PTR,
+			IARG_REG_VALUE, REG_ECX,
+			IARG_END);
+      INS_InsertThenCall (ins, IPOINT_BEFORE, (AFUNPTR) ReplayRaiseSignal,
+			  IARG_CALL_ORDER, CALL_ORDER_FIRST,
+			  IARG_THREAD_ID,
+			  IARG_CONTEXT,
+			  IARG_END);
+    }
+  if (INS_IsBranchOrCall (ins) || INS_IsRet (ins))
+    INS_InsertCall (ins, IPOINT_BEFORE, (AFUNPTR) ReplayCountBranch,
+		    IARG_CALL_ORDER, CALL_ORDER_FIRST + 1,
+		    IARG_THREAD_ID,
+		    IARG_END);
+
+  if (INS_Opcode (ins) == XED_ICLASS_RDTSC)
+    kind = TRACE_REPLAY_RDTSC;
+  else if (INS_Opcode (ins) == XED_ICLASS_CPUID)
+    kind = TRACE_REPLAY_CPUID;
+  else
+    return;
+
+  if (replaying)
+    INS_InsertCall (ins, IPOINT_AFTER, (AFUNPTR) ReplayValues,
+		    IARG_THREAD_ID,
+		    IARG_UINT32, kind,
+		    IARG_REG_REFERENCE, REG_EAX,
+		    IARG_REG_REFERENCE, REG_EBX,
+		    IARG_REG_REFERENCE, REG_ECX,
+		    IARG_REG_REFERENCE, REG_EDX,
+		    IARG_END);
+  else
+    INS_InsertCall (ins, IPOINT_AFTER, (AFUNPTR) RecordReplayValues,
+		    IARG_THREAD_ID,
+		    IARG_UINT32, kind,
+		    IARG_REG_VALUE, REG_EAX,
+		    IARG_REG_VALUE, REG_EBX,
+		    IARG_REG_VALUE, REG_ECX,
+		    IARG_REG_VALUE, REG_EDX,
+		    IARG_END);
+}
+
+//! @brief logs a signal delivered to the thread, or checks it against the
+//         log on replay
+//! @brief counts the instructions run in record mode, by block, as the
+//         tracer does in its other modes
+VOID ReplayTrace (TRACE trace, VOID *v)
+{
+  for (BBL bbl = TRACE_BblHead (trace); BBL_Valid (bbl); bbl = BBL_Next (bbl))
+    BBL_InsertCall (bbl, IPOINT_BEFORE, (AFUNPTR) ReplayCountInstructions,
+		    IARG_THREAD_ID,
+		    IARG_UINT32, BBL_NumIns (bbl),
+		    IARG_END);
+}
+
+VOID ReplayContextChange (THREADID tid, CONTEXT_CHANGE_REASON reason,
+			  const CONTEXT *from, CONTEXT *to, INT32 sig,
+			  VOID *v)
+{
+  ReplayThread *t = replayThreads[tid];
+  ReplayPosition *p = &replayPositions[tid];
+  TraceReplayRecord record;
+
+  if (reason != CONTEXT_CHANGE_REASON_SIGNAL || ReplayIsSynchronous (sig) ||
+      t == NULL || t->diverged)
+    return;
+
+  if (!replaying)
+    {
+      memset (&record, 0, sizeof (record));
+      record.kind = TRACE_REPLAY_SIGNAL;
+      record.number = sig;
+      record.syscalls = t->syscalls;
+      record.values[0] = p->branches;
+      record.values[1] = p->branches >> 32;
+      record.values[2] = PIN_GetContextReg (from, REG_INST_PTR);
+      record.values[3] = PIN_GetContextReg (from, REG_ECX);
+      t->file->Write (&record, sizeof (record));
+      return;
+    }
+
+  TraceReplayRecord *next;
+  if (!PeekReplayRecord (t, &next) || next->kind != TRACE_REPLAY_SIGNAL ||
+      next->number != (UINT32) sig)
+    {
+      ReplayDiverge (tid, "signal was not recorded");
+      return;
+    }
+  if (next->syscalls != t->syscalls ||
+      (next->values[0] | (UINT64) next->values[1] << 32) != p->branches ||
+      next->values[2] != PIN_GetContextReg (from, REG_INST_PTR) ||
+      next->values[3] != PIN_GetContextReg (from, REG_ECX))
+    {
+      ReplayDiverge (tid, "signal was recorded elsewhere");
+      return;
+    }
+  NextReplayRecord (t, &record);
+  ArmDueSignal (tid);
+}
+
+VOID ReplayThreadStart (THREADID tid, CONTEXT *ctxt, INT32 flags, VOID *v)
+{
+  ReplayThread *t = new ReplayThread;
+
+  ASSERTX (tid < REPLAY_MAX_THREADS);
+  t->syscalls = 0;
+  t->inSyscall = t->peeked = t->diverged = false;
+  t->spec = NULL;
+  t->file = NULL;
+  t->log = NULL;
+  replayThreads[tid] = t;
+  replayPositions[tid].instructions = 0;
+  replayPositions[tid].branches = 0;
+  replayPositions[tid].dueIp = 0;
+
+  if (!replaying)
+    {
+      TraceHeader header;
+
+      t->file = OpenSink (replaySink, ReplayLogName (tid).c_str ());
+      ASSERTX (t->file);
+      memset (&header, 0, sizeof (header));
+      header.magic = TRACE_MAGIC;
+      header.version = TRACE_VERSION;
+      header.stream = TRACE_STREAM_REPLAY;
+      header.thread = tid;
+      t->file->Write (&header, sizeof (header));
+      return;
+    }
+
+  TraceHeader header;
+  std::string path = replayDirectory + "/" + ReplayLogName (tid);
+  t->log = fopen (path.c_str (), "rb");
+  if (t->log == NULL ||
+      fread (&header, sizeof (header), 1, t->log) != 1 ||
+      header.magic != TRACE_MAGIC || header.stream != TRACE_STREAM_REPLAY)
+    {
+      ReplayDiverge (tid, "no log");
+      return;
+    }
+  ArmDueSignal (tid);
+}
+
+VOID ReplayThreadFini (THREADID tid, const CONTEXT *ctxt, INT32 code, VOID *v)
+{
+  ReplayThread *t = replayThreads[tid];
+
+  if (t == NULL)
+    return;
+  replayThreads[tid] = NULL;
+  if (t->file)
+    {
+      t->file->Close ();
+      delete t->file;
+    }
+  if (t->log)
+    fclose (t->log);
+  delete t;
+}
+
+VOID ReplayFini (INT32 code, VOID *v)
+{
+  UINT64 instructions = 0;
+
+  // threads still alive at exit never see their ThreadFini
+  for (THREADID tid = 0; tid < REPLAY_MAX_THREADS; tid++)
+    {
+      ReplayThreadFini (tid, NULL, code, v);
+      instructions += replayPositions[tid].instructions;
+    }
+  // on replay, the tracer reports the instructions it traced
+  if (!replaying)
+    std::cerr << "Instruction Count = " << instructions << std::endl;
+}
+
+//! @brief sets up record mode, in which nothing else is instrumented, to
+//         be called from main
+static VOID
+ReplayRecordInit (const std::string &sink)
+{
+  replaySink = sink;
+  INS_AddInstrumentFunction (ReplayInstrument, 0);
+  TRACE_AddInstrumentFunction (ReplayTrace, 0);
+  PIN_AddSyscallEntryFunction (RecordReplaySyscallEntry, 0);
+  PIN_AddSyscallExitFunction (RecordReplaySyscallExit, 0);
+  PIN_AddContextChangeFunction (ReplayContextChange, 0);
+  PIN_AddThreadStartFunction (ReplayThreadStart, 0);
+  PIN_AddThreadFiniFunction (ReplayThreadFini, 0);
+  PIN_AddFiniFunction (ReplayFini, 0);
+}
+
+//! @brief sets up replay mode of the logs in directory, along with the
+//         tracing, to be called from main
+static VOID
+ReplayInit (const std::string &directory)
+{
+  replaying = true;
+  replayDirectory = directory;
+  INS_AddInstrumentFunction (ReplayInstrument, 0);
+  PIN_AddSyscallEntryFunction (ReplaySyscallEntry, 0);
+  PIN_AddSyscallExitFunction (ReplaySyscallExit, 0);
+  PIN_AddContextChangeFunction (ReplayContextChange, 0);
+  PIN_AddThreadStartFunction (ReplayThreadStart, 0);
+  PIN_AddThreadFiniFunction (ReplayThreadFini, 0);
+  PIN_AddFiniFunction (ReplayFini, 0);
+}
+
+#endif
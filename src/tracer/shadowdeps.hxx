@@ -0,0 +1,297 @@
+/*! @file
+ *  shadowdeps : dependence mode of the naive tracer. Shadow registers &
+ *  shadow memory hold the last writer of every register & byte, so that
+ *  each executed instruction is logged with the instructions it depends
+ *  on, see "Dependence Graph" in traceformat.hxx. Slices are then read
+ *  off the graph instead of scanning the traces backwards.
+ */
+
+#ifndef __SHADOWDEPS_HXX
+#define __SHADOWDEPS_HXX
+
+#include "pin.H"
+#include "traceformat.hxx"
+#include "tracesink.hxx"
+#include <string.h>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+
+// shadow memory is allocated in pages of 64K bytes, on first write
+#define SHADOW_PAGE_BITS 16
+#define SHADOW_PAGES (1 << (32 - SHADOW_PAGE_BITS))
+
+#define DEP_MAX_THREADS 64
+#define DEP_MAX_REGS 16
+
+//! @brief registers used & defined by a static instruction
+struct DepInstruction
+{
+  UINT32 ip;
+  UINT32 nUses;
+  UINT32 nDefs;
+  REG uses[DEP_MAX_REGS];
+  REG defs[DEP_MAX_REGS];
+};
+
+struct DepThread
+{
+  UINT64 nodes;
+  UINT32 lastIp;
+
+  // last writer of every register, as a shadow word
+  UINT64 regWriters[REG_LAST];
+
+  // writers of the uses of the current instruction, as shadow words
+  std::vector<UINT64> writers;
+  std::vector<UINT64> words;
+
+  // deps of the last record of every slot, as encoded
+  std::vector<UINT64> slotWords[TRACE_SLOTS];
+
+  UINT8 *buffer;
+  UINT8 *cursor;
+  UINT8 *limit;
+  TraceSink *file;
+};
+
+static DepThread *depThreads[DEP_MAX_THREADS];
+static UINT64 * volatile shadowPages[SHADOW_PAGES];
+static UINT32 depBufferSize;
+static std::string depSink;
+// nodes of the threads done, i.e. instructions they executed
+static UINT64 depInstructions;
+
+//! @return shadow word of node n of thread tid, 0 stands for no writer
+static inline UINT64
+ShadowWord (THREADID tid, UINT64 n)
+{
+  return (UINT64) tid << 48 | (n + 1);
+}
+
+static UINT64 *
+ShadowPage (ADDRINT addr)
+{
+  UINT32 page = addr >> SHADOW_PAGE_BITS;
+
+  if (shadowPages[page] == NULL)
+    {
+      UINT64 *fresh = new UINT64[1 << SHADOW_PAGE_BITS];
+      memset (fresh, 0, sizeof (UINT64) << SHADOW_PAGE_BITS);
+      if (!__sync_bool_compare_and_swap (&shadowPages[page], NULL, fresh))
+	delete [] fresh;
+    }
+  return shadowPages[page];
+}
+
+static VOID
+DepReadMem (THREADID tid, ADDRINT addr, UINT32 size)
+{
+  DepThread *t = depThreads[tid];
+
+  for (ADDRINT a = addr; a < addr + size; a++)
+    {
+      UINT64 *page = shadowPages[a >> SHADOW_PAGE_BITS];
+      UINT64 writer = page ? page[a & ((1 << SHADOW_PAGE_BITS) - 1)] : 0;
+      if (writer && (t->writers.empty () || t->writers.back () != writer))
+	t->writers.push_back (writer);
+    }
+}
+
+//! @brief inserted after the reads of the same instruction
+static VOID
+DepWriteMem (THREADID tid, ADDRINT addr, UINT32 size)
+{
+  DepThread *t = depThreads[tid];
+  UINT64 word = ShadowWord (tid, t->nodes);
+
+  for (ADDRINT a = addr; a < addr + size; a++)
+    ShadowPage (a)[a & ((1 << SHADOW_PAGE_BITS) - 1)] = word;
+}
+
+static VOID
+DepFlush (DepThread *t)
+{
+  t->file->Write (t->buffer, t->cursor - t->buffer);
+  t->cursor = t->buffer;
+}
+
+//! @brief logs the node of an executed instruction, after its memory
+//         accesses, and makes it the writer of the registers it defines
+static VOID
+DepCommit (THREADID tid, DepInstruction *ins)
+{
+  DepThread *t = depThreads[tid];
+  UINT64 n = t->nodes;
+  UINT32 i;
+
+  for (i = 0; i < ins->nUses; i++)
+    if (t->regWriters[ins->uses[i]])
+      t->writers.push_back (t->regWriters[ins->uses[i]]);
+  std::sort (t->writers.begin (), t->writers.end ());
+  t->writers.erase (std::unique (t->writers.begin (), t->writers.end ()),
+		    t->writers.end ());
+
+  t->words.clear ();
+  for (i = 0; i < t->writers.size (); i++)
+    {
+      THREADID writerTid = t->writers[i] >> 48;
+      UINT64 writer = (t->writers[i] & ((1ULL << 48) - 1)) - 1;
+      if (writerTid == tid)
+	t->words.push_back ((n - writer) << 1);
+      else
+	{
+	  t->words.push_back (TraceDepThread (writerTid));
+	  t->words.push_back (writer);
+	}
+    }
+  t->writers.clear ();
+
+  // a record holds at most 10 bytes of ip & repeat, a count and the words
+  UINT32 recordBytes = 20 + 10 * t->words.size ();
+  ASSERTX (recordBytes <= depBufferSize);
+  if (t->cursor + recordBytes > t->limit)
+    DepFlush (t);
+
+  std::vector<UINT64> &last = t->slotWords[TraceSlot (ins->ip, 0)];
+  UINT64 repeat = last == t->words;
+  UINT8 *p = t->cursor;
+  p = TraceEncodeVarint (p, (UINT64) TraceZigzag (ins->ip - t->lastIp) << 1
+			 | repeat);
+  if (!repeat)
+    {
+      p = TraceEncodeVarint (p, t->words.size ());
+      for (i = 0; i < t->words.size (); i++)
+	p = TraceEncodeVarint (p, t->words[i]);
+      last.swap (t->words);
+    }
+  t->cursor = p;
+  t->lastIp = ins->ip;
+
+  for (i = 0; i < ins->nDefs; i++)
+    t->regWriters[ins->defs[i]] = ShadowWord (tid, n);
+  t->nodes++;
+}
+
+//! @brief adds reg to a register list, by its full name
+static VOID
+AddDepReg (REG *regs, UINT32 &count, REG reg)
+{
+  reg = REG_FullRegName (reg);
+  if (!REG_valid (reg) || reg == REG_INST_PTR)
+    return;
+  for (UINT32 i = 0; i < count; i++)
+    if (regs[i] == reg)
+      return;
+  ASSERTX (count < DEP_MAX_REGS);
+  regs[count++] = reg;
+}
+
+VOID DepInstrument (INS ins, VOID *v)
+{
+  DepInstruction *dep = new DepInstruction;
+  UINT32 i;
+
+  dep->ip = INS_Address (ins);
+  dep->nUses = dep->nDefs = 0;
+  for (i = 0; i < INS_MaxNumRRegs (ins); i++)
+    AddDepReg (dep->uses, dep->nUses, INS_RegR (ins, i));
+  for (i = 0; i < INS_MaxNumWRegs (ins); i++)
+    {
+      REG reg = INS_RegW (ins, i);
+
+      // a write of part of a register keeps the rest of it
+      if (REG_valid (reg) && REG_FullRegName (reg) != reg)
+	AddDepReg (dep->uses, dep->nUses, reg);
+      AddDepReg (dep->defs, dep->nDefs, reg);
+    }
+
+  if (INS_IsMemoryRead (ins))
+    INS_InsertPredicatedCall (ins, IPOINT_BEFORE, (AFUNPTR) DepReadMem,
+			      IARG_THREAD_ID,
+			      IARG_MEMORYREAD_EA,
+			      IARG_MEMORYREAD_SIZE,
+			      IARG_END);
+  if (INS_HasMemoryRead2 (ins))
+    INS_InsertPredicatedCall (ins, IPOINT_BEFORE, (AFUNPTR) DepReadMem,
+			      IARG_THREAD_ID,
+			      IARG_MEMORYREAD2_EA,
+			      IARG_MEMORYREAD_SIZE,
+			      IARG_END);
+  if (INS_IsMemoryWrite (ins))
+    INS_InsertPredicatedCall (ins, IPOINT_BEFORE, (AFUNPTR) DepWriteMem,
+			      IARG_THREAD_ID,
+			      IARG_MEMORYWRITE_EA,
+			      IARG_MEMORYWRITE_SIZE,
+			      IARG_END);
+  INS_InsertCall (ins, IPOINT_BEFORE, (AFUNPTR) DepCommit,
+		  IARG_THREAD_ID,
+		  IARG_PTR, dep,
+		  IARG_END);
+}
+
+VOID DepThreadStart (THREADID tid, CONTEXT *ctxt, INT32 flags, VOID *v)
+{
+  DepThread *t = new DepThread;
+  std::stringstream fileName;
+  TraceHeader header;
+
+  ASSERTX (tid < DEP_MAX_THREADS);
+  t->nodes = 0;
+  t->lastIp = 0;
+  memset (t->regWriters, 0, sizeof (t->regWriters));
+  t->buffer = t->cursor = new UINT8[depBufferSize];
+  t->limit = t->buffer + depBufferSize;
+
+  fileName << ".trace.deps";
+  if (tid != 0)
+    fileName << "." << tid;
+  t->file = OpenSink (depSink, fileName.str ().c_str ());
+  ASSERTX (t->file);
+
+  memset (&header, 0, sizeof (header));
+  header.magic = TRACE_MAGIC;
+  header.version = TRACE_VERSION;
+  header.stream = TRACE_STREAM_DEPS;
+  header.thread = tid;
+  t->file->Write (&header, sizeof (header));
+  depThreads[tid] = t;
+}
+
+VOID DepThreadFini (THREADID tid, const CONTEXT *ctxt, INT32 code, VOID *v)
+{
+  DepThread *t = depThreads[tid];
+
+  if (t == NULL)
+    return;
+  depThreads[tid] = NULL;
+  __sync_fetch_and_add (&depInstructions, t->nodes);
+  DepFlush (t);
+  t->file->Close ();
+  delete t->file;
+  delete [] t->buffer;
+  delete t;
+}
+
+VOID DepFini (INT32 code, VOID *v)
+{
+  // threads still alive at exit never see their ThreadFini
+  for (THREADID tid = 0; tid < DEP_MAX_THREADS; tid++)
+    DepThreadFini (tid, NULL, code, v);
+  std::cerr << "Instruction Count = " << depInstructions << std::endl;
+}
+
+//! @brief sets up dependence mode, to be called from main
+static VOID
+DepInit (UINT32 bufferSize, const std::string &sink)
+{
+  depBufferSize = bufferSize;
+  depSink = sink;
+  INS_AddInstrumentFunction (DepInstrument, 0);
+  PIN_AddThreadStartFunction (DepThreadStart, 0);
+  PIN_AddThreadFiniFunction (DepThreadFini, 0);
+  PIN_AddFiniFunction (DepFini, 0);
+}
+
+#endif
@@ -0,0 +1,312 @@
+/*! @file
+ *  shmdrain : consumer of the rings of the naive tracer run with -sink shm,
+ *  see tracering.hxx. Drains every ring as the tracer fills it and writes
+ *  the trace files it carries into an output directory, which then holds
+ *  what the tracer would have written by itself. Other consumers, such as
+ *  indexers or online analyzers, plug in as a StreamConsumer. Given a
+ *  store, the trace files are written to it, see tracestore.hxx, and the
+ *  output directory only holds their manifests.
+ *
+ *  usage: shmdrain [<shm_name> [<output directory> [<store>]]]
+ */
+
+#include "tracering.hxx"
+#include "tracestore.hxx"
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <iostream>
+#include <vector>
+
+extern "C"
+{
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+}
+
+using namespace std;
+
+//! @class receives the bytes of one trace file, in order
+class StreamConsumer
+{
+public:
+  virtual ~StreamConsumer () {}
+  virtual bool Data (const void *buffer, uint32_t size) = 0;
+  virtual bool Patch (uint64_t offset, const void *buffer,
+		      uint32_t size) = 0;
+  virtual void Close () = 0;
+};
+
+//! @class writes a trace file as is
+class FileConsumer: public StreamConsumer
+{
+  int fd;
+public:
+  FileConsumer (const string &path)
+  { fd = open (path.c_str (), O_WRONLY | O_CREAT | O_TRUNC, 0644); }
+  bool IsOpen () { return fd >= 0; }
+  bool Data (const void *buffer, uint32_t size)
+  { return write (fd, buffer, size) == (ssize_t) size; }
+  bool Patch (uint64_t offset, const void *buffer, uint32_t size)
+  { return pwrite (fd, buffer, size, offset) == (ssize_t) size; }
+  void Close () { close (fd); }
+};
+
+//! @class writes a trace file into a store, and its manifest in its stead
+class StoreConsumer: public StreamConsumer
+{
+  string path;
+  TraceStoreWriter writer;
+public:
+  StoreConsumer (const string &store, const string &path)
+    : path (path), writer (store, path) {}
+  bool Data (const void *buffer, uint32_t size)
+  { return writer.Data (buffer, size); }
+  bool Patch (uint64_t offset, const void *buffer, uint32_t size)
+  { return writer.Patch (offset, buffer, size); }
+  void Close ()
+  {
+    if (!writer.Close ())
+      cerr << path << ": could not store trace" << endl;
+  }
+};
+
+//! @brief ring being drained
+struct Stream
+{
+  uint32_t slot;                // in the registry
+  string name;
+  string ringName;
+  TraceRing *ring;
+  size_t mapSize;
+  int spillFd;
+  StreamConsumer *consumer;
+  bool finished;
+};
+
+static TraceRingRegistry *registry;
+static string registryName = "/dstr";
+static string outputDirectory = ".";
+static string storeDirectory;   // empty to write trace files as is
+
+//! @return shared memory object mapped whole, NULL if it does not exist
+static void *
+MapShm (const string &name, size_t *size)
+{
+  struct stat status;
+  void *shm = MAP_FAILED;
+  int fd = open (TraceShmPath (name).c_str (), O_RDWR);
+
+  if (fd < 0)
+    return NULL;
+  if (fstat (fd, &status) == 0 && status.st_size != 0)
+    {
+      *size = status.st_size;
+      shm = mmap (NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+  close (fd);
+  return shm == MAP_FAILED ? NULL : shm;
+}
+
+//! @return consumer of a trace file, in the output directory
+static StreamConsumer *
+NewConsumer (const string &name)
+{
+  string path = outputDirectory + "/" + name;
+
+  // segments come in directories of their own
+  size_t slash = name.rfind ('/');
+  if (slash != string::npos)
+    mkdir ((outputDirectory + "/" + name.substr (0, slash)).c_str (), 
+	   0777);
+
+  if (!storeDirectory.empty ())
+    return new StoreConsumer (storeDirectory, path);
+  FileConsumer *consumer = new FileConsumer (path);
+  if (!consumer->IsOpen ())
+    {
+      perror (path.c_str ());
+      delete consumer;
+      return NULL;
+    }
+  return consumer;
+}
+
+static bool
+Attach (Stream *s, uint32_t n)
+{
+  s->slot = n;
+  s->name = registry->streams[n].name;
+  s->ringName = TraceRingName (registryName, n);
+  s->ring = (TraceRing *) MapShm (s->ringName, &s->mapSize);
+  s->spillFd = -1;
+  s->finished = false;
+  if (s->ring == NULL || s->ring->magic != TRACE_RING_MAGIC)
+    return false;
+  s->consumer = NewConsumer (s->name);
+  return s->consumer != NULL;
+}
+
+static string
+SpillPath (Stream *s)
+{
+  return string (registry->directory) + "/" + s->name + ".spill";
+}
+
+//! @brief copies spilled bytes of the file to the consumer
+static bool
+ReadSpill (Stream *s, uint64_t offset, uint32_t size)
+{
+  vector<char> buffer (65536);
+
+  if (s->spillFd < 0)
+    {
+      string path = SpillPath (s);
+      s->spillFd = open (path.c_str (), O_RDONLY);
+      if (s->spillFd < 0)
+	{
+	  perror (path.c_str ());
+	  return false;
+	}
+    }
+
+  while (size > 0)
+    {
+      uint32_t n = size < buffer.size () ? size : buffer.size ();
+      if (pread (s->spillFd, &buffer[0], n, offset) != (ssize_t) n ||
+	  !s->consumer->Data (&buffer[0], n))
+	return false;
+      offset += n;
+      size -= n;
+    }
+  return true;
+}
+
+//! @brief hands the published messages of a ring to its consumer & frees
+//         their room, and retires the ring once closed & empty, giving
+//         its slot back to the tracer
+//  @return whether there were messages
+static bool
+Drain (Stream *s)
+{
+  TraceRing *ring = s->ring;
+  bool closed = ring->closed;
+  uint32_t head = ring->head, tail = ring->tail, start = tail;
+  vector<char> payload;
+
+  // the messages up to head are complete once head is read
+  __sync_synchronize ();
+  for (; tail != head; tail += TraceMessageBytes (payload.size ()))
+    {
+      TraceMessage message;
+      bool ok;
+
+      TraceRingCopyOut (ring, tail, &message, sizeof (message));
+      payload.resize (message.kind == TRACE_MESSAGE_SPILL ? 
+		      0 : message.size);
+      if (!payload.empty ())
+	TraceRingCopyOut (ring, tail + sizeof (message), &payload[0],
+			  payload.size ());
+
+      if (message.kind == TRACE_MESSAGE_DATA)
+	ok = s->consumer->Data (&payload[0], payload.size ());
+      else if (message.kind == TRACE_MESSAGE_SPILL)
+	ok = ReadSpill (s, message.offset, message.size);
+      else
+	ok = s->consumer->Patch (message.offset, &payload[0],
+				 payload.size ());
+      if (!ok)
+	{
+	  cerr << s->name << ": lost trace bytes" << endl;
+	  exit (1);
+	}
+
+      // the tracer reuses the room once tail moves
+      __sync_synchronize ();
+      ring->tail = tail + TraceMessageBytes (payload.size ());
+    }
+
+  // closed was read before head, so nothing follows the last message
+  if (closed)
+    {
+      s->consumer->Close ();
+      delete s->consumer;
+      munmap (ring, s->mapSize);
+      unlink (TraceShmPath (s->ringName).c_str ());
+      if (s->spillFd >= 0)
+	{
+	  close (s->spillFd);
+	  unlink (SpillPath (s).c_str ());
+	}
+      s->finished = true;
+      __sync_synchronize ();
+      registry->streams[s->slot].state = TRACE_RING_FREE;
+    }
+  return tail != start || closed;
+}
+
+int
+main (int argc, char **argv)
+{
+  vector<Stream> streams;
+  size_t registrySize;
+
+  if (argc > 4)
+    {
+      cerr << "usage: " << argv[0]
+	   << " [<shm_name> [<output directory> [<store>]]]" << endl;
+      return 1;
+    }
+  if (argc > 1)
+    registryName = argv[1];
+  if (argc > 2)
+    outputDirectory = argv[2];
+  if (argc > 3)
+    storeDirectory = argv[3];
+
+  // the consumer may start before the tracer
+  while ((registry = (TraceRingRegistry *)
+	  MapShm (registryName, &registrySize)) == NULL ||
+	 registry->magic != TRACE_RING_MAGIC)
+    {
+      if (registry)
+	munmap (registry, registrySize);
+      usleep (10000);
+    }
+
+  streams.resize (TRACE_RING_STREAMS);
+  for (uint32_t n = 0; n < TRACE_RING_STREAMS; n++)
+    streams[n].finished = true;
+  for (;;)
+    {
+      bool done = registry->done, busy = false, claimed = false;
+
+      // a ready slot of no stream being drained holds a new ring, as
+      // slots are freed only once drained
+      for (uint32_t n = 0; n < TRACE_RING_STREAMS; n++)
+	{
+	  uint32_t state = registry->streams[n].state;
+
+	  claimed |= state != TRACE_RING_FREE;
+	  if (state == TRACE_RING_READY && streams[n].finished &&
+	      !Attach (&streams[n], n))
+	    {
+	      cerr << "could not attach to ring " << n << endl;
+	      return 1;
+	    }
+	  if (!streams[n].finished)
+	    busy |= Drain (&streams[n]);
+	}
+
+      if (done && !claimed)
+	break;
+      if (!busy)
+	usleep (1000);
+    }
+
+  munmap (registry, registrySize);
+  unlink (TraceShmPath (registryName).c_str ());
+  return 0;
+}
@@ -0,0 +1,31 @@
+/* frames : program of slice.test. Built without optimization, its
+   functions keep their locals in EBP frames torn down by leave, so that
+   slicing its trace crosses a leave at every return. */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static int
+sum (int n)
+{
+  int local = n;
+
+  if (n == 0)
+    return 0;
+  return local + sum (n - 1);
+}
+
+static void
+report (int value)
+{
+  printf ("%d\n", value);
+}
+
+int
+main (int argc, char **argv)
+{
+  int total = sum (argc > 1 ? atoi (argv[1]) : 100);
+
+  report (total);
+  return 0;
+}
@@ -39,16 +39,17 @@ END_LEGAL */
  */
 
 #include "pin.H"
+#include "tracesink.hxx"
 #include <iostream>
 #include <map>
 #include <fstream>
+#include <sstream>
 #include <iomanip>
 /* ===================================================================== */
 /* Global Variables */
 /* ===================================================================== */
 using namespace std;
-ofstream TraceFile;
-ofstream TraceIndexFile;
+TraceSink *TraceFile;
 ofstream TraceStats;
 
 /* ===================================================================== */
@@ -59,6 +60,14 @@ KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool",
     "o", "pinatrace.out", "specify trace file name");
 KNOB<BOOL> KnobValues(KNOB_MODE_WRITEONCE, "pintool",
     "values", "1", "Output memory values reads and written");
+KNOB<string> KnobSink(KNOB_MODE_WRITEONCE, "pintool",
+    "sink", "mmap", "output of the trace: mmap or stream");
+KNOB<UINT32> KnobIndex(KNOB_MODE_WRITEONCE, "pintool",
+    "index", "65536", "number of trace records of a thread between two "
+    "entries of its .trace.index");
+KNOB<UINT32> KnobStatsPeriod(KNOB_MODE_WRITEONCE, "pintool",
+    "stats_period", "1000", "milliseconds between two snapshots of the "
+    "tracing throughput in .stats, 0 for none");
 
 /* ===================================================================== */
 
@@ -76,41 +85,110 @@ static INT32 Usage()
     return -1;
 }
 
-static INT32 ins_count = 0, r_count = 0, w_count = 0;
-static map<int,int> ins_static, ins_dynamic;
-
 enum {INS_REGISTER = 0, INS_IMMEDIATE , INS_DIRECT, INS_INDIRECT,
-      INS_INDEXED, INS_SCALED};
+      INS_INDEXED, INS_SCALED, INS_TYPES};
+
+#define MAX_THREADS 64
+
+// size of a record of .trace
+#define RECORD_SIZE (sizeof(VOID *) * 2 + sizeof(INT32))
 
-static VOID RecordMem(VOID * ip, CHAR r, VOID * addr, INT32 size, BOOL isPrefetch)
+//! @brief counters of a thread, only ever written by that thread and
+//         summed up when reported
+enum {STAT_INS = 0, STAT_READS, STAT_WRITES, STAT_TYPES,
+      STAT_COUNTERS = STAT_TYPES + INS_TYPES};
+
+struct ThreadStats
 {
-    TraceFile.write ((char *) &ip, sizeof(ip));
-    TraceFile.write ((char *) &addr,sizeof(addr));
-    TraceFile.write ((char *) &size,sizeof(size));
+    UINT64 counters[STAT_COUNTERS];
+    // keeps the counters of two threads off the same cache line
+    UINT8 pad[64];
+};
+
+static ThreadStats threadStats[MAX_THREADS];
+static UINT64 ins_static[INS_TYPES];
+
+// records written to .trace, which orders them, and the lock all threads
+// write them under
+static UINT64 records;
+static PIN_LOCK traceLock;
+
+// .trace.index of every thread, suffixed by the thread id but for the main
+// thread
+static ofstream *indexFiles[MAX_THREADS];
+
+static PIN_THREAD_UID statsThreadUid;
+static PIN_SEMAPHORE statsStop;
+
+//! @return sum of a counter over all threads
+static UINT64 SumStats(UINT32 counter)
+{
+    UINT64 sum = 0;
+    for (THREADID tid = 0; tid < MAX_THREADS; tid++)
+      sum += threadStats[tid].counters[counter];
+    return sum;
+}
+
+//! @brief logs at every KnobIndex-th record of a thread the instructions
+//         it ran so far, and the position of the record in .trace, whose
+//         records all have the same size. Called under traceLock.
+static VOID RecordIndex(THREADID tid)
+{
+    UINT64 entry[3];
+
+    entry[0] = threadStats[tid].counters[STAT_INS];
+    entry[1] = records;
+    entry[2] = entry[1] * RECORD_SIZE;
+    indexFiles[tid]->write ((char *) entry, sizeof(entry));
+}
+
+static VOID RecordMem(THREADID tid, VOID * ip, CHAR r, VOID * addr, INT32 size, BOOL isPrefetch)
+{
+    UINT8 record[RECORD_SIZE];
+    UINT64 *counters = threadStats[tid].counters;
+    BOOL indexed =
+      (counters[STAT_READS] + counters[STAT_WRITES]) % KnobIndex.Value() == 0;
+
+    // the sink has a single owner, a record goes in whole under the lock
+    memcpy (record, &ip, sizeof(ip));
+    memcpy (record + sizeof(ip), &addr, sizeof(addr));
+    memcpy (record + sizeof(ip) + sizeof(addr), &size, sizeof(size));
+    GetLock (&traceLock, tid + 1);
+    if (indexed)
+      RecordIndex(tid);
+    TraceFile->Write (record, RECORD_SIZE);
+    records++;
+    ReleaseLock (&traceLock);
     if (r == 'R')
-      r_count ++;
+      counters[STAT_READS]++;
     else if (r == 'W')
-      w_count ++;
+      counters[STAT_WRITES]++;
 }
 
-static VOID * WriteAddr;
-static INT32 WriteSize;
+// store of each thread, logged after it completes
+static struct
+{
+    VOID * addr;
+    INT32 size;
+} pendingWrites[MAX_THREADS];
 
-static VOID RecordWriteAddrSize(VOID * addr, INT32 size)
+static VOID RecordWriteAddrSize(THREADID tid, VOID * addr, INT32 size)
 {
-    WriteAddr = addr;
-    WriteSize = size;
+    pendingWrites[tid].addr = addr;
+    pendingWrites[tid].size = size;
 }
 
-static VOID RecordInsType (INT32 type)
+static VOID RecordInsType (THREADID tid, INT32 type)
 {
-  ins_count++;
-  ins_dynamic[type]++;
+  UINT64 *counters = threadStats[tid].counters;
+  counters[STAT_INS]++;
+  counters[STAT_TYPES + type]++;
 } 
 
-static VOID RecordMemWrite(VOID * ip)
+static VOID RecordMemWrite(THREADID tid, VOID * ip)
 {
-    RecordMem(ip, 'W', WriteAddr, WriteSize, false);
+    RecordMem(tid, ip, 'W', pendingWrites[tid].addr, pendingWrites[tid].size,
+              false);
 }
 
 VOID Instruction(INS ins, VOID *v)
@@ -147,6 +225,7 @@ VOID Instruction(INS ins, VOID *v)
       
   INS_InsertCall (
 		  ins, IPOINT_BEFORE, (AFUNPTR) RecordInsType,
+		  IARG_THREAD_ID,
 		  IARG_UINT32, insType,
 		  IARG_END
 		  );
@@ -155,6 +234,7 @@ VOID Instruction(INS ins, VOID *v)
     {
       INS_InsertPredicatedCall(
             ins, IPOINT_BEFORE, (AFUNPTR)RecordMem,
+            IARG_THREAD_ID,
             IARG_INST_PTR,
             IARG_UINT32, 'R',
             IARG_MEMORYREAD_EA,
@@ -167,6 +247,7 @@ VOID Instruction(INS ins, VOID *v)
     {
         INS_InsertPredicatedCall(
             ins, IPOINT_BEFORE, (AFUNPTR)RecordMem,
+            IARG_THREAD_ID,
             IARG_INST_PTR,
             IARG_UINT32, 'R',
             IARG_MEMORYREAD2_EA,
@@ -181,6 +262,7 @@ VOID Instruction(INS ins, VOID *v)
     {
         INS_InsertPredicatedCall(
             ins, IPOINT_BEFORE, (AFUNPTR)RecordWriteAddrSize,
+            IARG_THREAD_ID,
             IARG_MEMORYWRITE_EA,
             IARG_MEMORYWRITE_SIZE,
             IARG_END);
@@ -189,6 +271,7 @@ VOID Instruction(INS ins, VOID *v)
         {
             INS_InsertCall(
                 ins, IPOINT_AFTER, (AFUNPTR)RecordMemWrite,
+                IARG_THREAD_ID,
                 IARG_INST_PTR,
                 IARG_END);
         }
@@ -196,6 +279,7 @@ VOID Instruction(INS ins, VOID *v)
         {
             INS_InsertCall(
                 ins, IPOINT_TAKEN_BRANCH, (AFUNPTR)RecordMemWrite,
+                IARG_THREAD_ID,
                 IARG_INST_PTR,
                 IARG_END);
         }
@@ -205,7 +289,7 @@ VOID Instruction(INS ins, VOID *v)
 
 /* ===================================================================== */
 
-static char *instructionType[6] =  {
+static const char *instructionType[INS_TYPES] =  {
   "REGISTER",
   "IMMEDIATE",
   "DIRECT",
@@ -214,23 +298,79 @@ static char *instructionType[6] =  {
   "SCALED"
 };
 
+VOID ThreadStart(THREADID tid, CONTEXT *ctxt, INT32 flags, VOID *v)
+{
+  stringstream name;
+
+  ASSERTX (tid < MAX_THREADS);
+  name << ".trace.index";
+  if (tid != 0)
+    name << "." << tid;
+  GetLock (&traceLock, tid + 1);
+  indexFiles[tid] = new ofstream (name.str ().c_str ());
+  ReleaseLock (&traceLock);
+}
+
+VOID ThreadFini(THREADID tid, const CONTEXT *ctxt, INT32 code, VOID *v)
+{
+  GetLock (&traceLock, tid + 1);
+  delete indexFiles[tid];
+  indexFiles[tid] = NULL;
+  ReleaseLock (&traceLock);
+}
+
+//! @brief writes a line of throughput to .stats every KnobStatsPeriod
+//         milliseconds, from the counters of all threads
+static VOID StatsSnapshot(VOID *arg)
+{
+  UINT64 lastIns = 0, lastRecords = 0;
+  UINT32 period = KnobStatsPeriod.Value();
+  UINT32 elapsed = 0;
+
+  TraceStats << "# ms ins/s records/s bytes/s window-bytes\n";
+  while (!PIN_SemaphoreTimedWait (&statsStop, period))
+    {
+      UINT64 ins = SumStats (STAT_INS);
+      UINT64 recs = SumStats (STAT_READS) + SumStats (STAT_WRITES);
+
+      elapsed += period;
+      TraceStats << elapsed << " "
+		 << (ins - lastIns) * 1000 / period << " "
+		 << (recs - lastRecords) * 1000 / period << " "
+		 << (recs - lastRecords) * RECORD_SIZE * 1000 / period << " "
+		 << TraceFile->Buffered () << endl;
+      lastIns = ins;
+      lastRecords = recs;
+    }
+}
+
+//! @brief stops the snapshot thread before Fini writes the totals
+static VOID StatsPrepareForFini(VOID *v)
+{
+  PIN_SemaphoreSet (&statsStop);
+  PIN_WaitForThreadTermination (statsThreadUid, PIN_INFINITE_TIMEOUT, NULL);
+}
+
 VOID Fini(INT32 code, VOID *v)
 {
-  map<string, int>::iterator t;
-  TraceStats << "# Instructions = " << ins_count << "\n";
-  TraceStats << "# Read Instructions = " << r_count << "\n";
-  TraceStats << "# Write Instructions = " << w_count << "\n";
+  TraceStats << "# Instructions = " << SumStats (STAT_INS) << "\n";
+  TraceStats << "# Read Instructions = " << SumStats (STAT_READS) << "\n";
+  TraceStats << "# Write Instructions = " << SumStats (STAT_WRITES) << "\n";
   TraceStats << "\nStatic Addressing Mode Frequencies:\n";
   
-  for (int i = 0; i < 6; i++)
+  for (int i = 0; i < INS_TYPES; i++)
     TraceStats << instructionType[i] << ":  " << ins_static [i] << "\n";
 
   TraceStats << "\nDynamic Addressing Mode Frequencies:\n";
 
-  for (int i = 0; i < 6; i++)
-    TraceStats <<  instructionType[i] << ":  " << ins_dynamic [i] << "\n";
+  for (int i = 0; i < INS_TYPES; i++)
+    TraceStats <<  instructionType[i] << ":  " 
+	       << SumStats (STAT_TYPES + i) << "\n";
   
-  TraceFile.close();
+  // threads still alive at exit never see their ThreadFini
+  for (THREADID tid = 0; tid < MAX_THREADS; tid++)
+    delete indexFiles[tid];
+  TraceFile->Close();
   TraceStats.close();
 }
 
@@ -247,12 +387,33 @@ int main(int argc, char *argv[])
         return Usage();
     }
     
-    TraceFile.open(".trace");
+    if (KnobSink.Value () == "mmap")
+      SinkInit ();
+    InitLock (&traceLock);
+    TraceFile = OpenSink (KnobSink.Value (), ".trace");
+    if (TraceFile == NULL || KnobIndex.Value() == 0)
+    {
+        return Usage();
+    }
     //    TraceFile.write(trace_header.c_str(),trace_header.size());
     //    TraceFile.setf(ios::showbase);
     TraceStats.open(".stats");
+    // snapshots are taken by an internal thread of the Pin 2.14 kit, see
+    // makefile.gnu.config, stopped before Fini writes the totals
+    if (KnobStatsPeriod.Value() != 0)
+      {
+        PIN_SemaphoreInit (&statsStop);
+        if (PIN_SpawnInternalThread (StatsSnapshot, NULL, 0, &statsThreadUid)
+            != INVALID_THREADID)
+          PIN_AddPrepareForFiniFunction (StatsPrepareForFini, 0);
+        else
+          cerr << "no internal thread for -stats_period, .stats only "
+               << "holds the totals" << endl;
+      }
     
     INS_AddInstrumentFunction(Instruction, 0);
+    PIN_AddThreadStartFunction(ThreadStart, 0);
+    PIN_AddThreadFiniFunction(ThreadFini, 0);
     PIN_AddFiniFunction(Fini, 0);
 
     // Never returns
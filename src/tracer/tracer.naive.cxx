@@ -39,16 +39,30 @@ END_LEGAL */
  */
 
 #include "pin.H"
+#include "traceformat.hxx"
+#include "tracesink.hxx"
+#include "shadowdeps.hxx"
+#include "replaylog.hxx"
+#include "pathtable.hxx"
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <iostream>
 #include <map>
+#include <set>
+#include <deque>
+#include <vector>
 #include <fstream>
+#include <sstream>
 #include <iomanip>
+#include <algorithm>
 /* ===================================================================== */
 /* Global Variables */
 /* ===================================================================== */
 using namespace std;
-ofstream traceDataFile;
-ofstream traceControlFile;
 
 /* ===================================================================== */
 /* Commandline Switches */
@@ -58,6 +72,100 @@ KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool",
     "o", "pinatrace.out", "specify trace file name");
 KNOB<BOOL> KnobValues(KNOB_MODE_WRITEONCE, "pintool",
     "values", "1", "Output memory values reads and written");
+KNOB<UINT32> KnobBufferSize(KNOB_MODE_WRITEONCE, "pintool",
+    "buffer", "1048576", "size in bytes of each per-thread trace buffer");
+KNOB<BOOL> KnobCompact(KNOB_MODE_WRITEONCE, "pintool",
+    "compact", "1", "delta encode data addresses and omit access sizes");
+KNOB<BOOL> KnobPredict(KNOB_MODE_WRITEONCE, "pintool",
+    "predict", "1", "with -compact, code data addresses as hits of stride "
+    "& context predictors, or misses");
+KNOB<string> KnobControl(KNOB_MODE_WRITEONCE, "pintool",
+    "control", "ins", "granularity of the control trace: ins, bbl, or "
+    "paths to log the code of -paths as numbered paths of its regions");
+KNOB<string> KnobPaths(KNOB_MODE_WRITEONCE, "pintool",
+    "paths", "", "with -control paths, the .paths table of the analyzer");
+KNOB<BOOL> KnobRepeats(KNOB_MODE_WRITEONCE, "pintool",
+    "repeats", "1", "code repeated runs of control records, such as loop "
+    "iterations, as nested repeats");
+KNOB<BOOL> KnobElide(KNOB_MODE_WRITEONCE, "pintool",
+    "elide", "1", "omit addresses of EBP-relative operands; absolute ones "
+    "are never logged");
+KNOB<string> KnobSink(KNOB_MODE_WRITEONCE, "pintool",
+    "sink", "mmap", "output of the traces: mmap, stream, or shm to stream "
+    "them to a concurrent consumer such as shmdrain");
+KNOB<string> KnobShmName(KNOB_MODE_WRITEONCE, "pintool",
+    "shm_name", "/dstr", "with -sink shm, shared memory object listing the "
+    "rings, each named <shm_name>.<n>");
+KNOB<UINT32> KnobShmSize(KNOB_MODE_WRITEONCE, "pintool",
+    "shm_size", "16777216", "with -sink shm, size in bytes of the ring of "
+    "every trace file");
+KNOB<UINT32> KnobShmWait(KNOB_MODE_WRITEONCE, "pintool",
+    "shm_wait", "10", "with -sink shm, milliseconds to wait for room in a "
+    "full ring before spilling to <file>.spill");
+KNOB<UINT64> KnobIndex(KNOB_MODE_WRITEONCE, "pintool",
+    "index", "0", "minimum number of instructions between two entries of "
+    ".trace.index, 0 for an entry at every flush");
+KNOB<UINT64> KnobRing(KNOB_MODE_WRITEONCE, "pintool",
+    "ring", "0", "flight recorder: keep the last <n> million instructions "
+    "in memory and write them out on a trigger only, 0 to trace to disk");
+KNOB<ADDRINT> KnobTriggerIp(KNOB_MODE_WRITEONCE, "pintool",
+    "trigger_ip", "0", "flight recorder: dump once the instruction at this "
+    "address has executed trigger_count times");
+KNOB<UINT64> KnobTriggerCount(KNOB_MODE_WRITEONCE, "pintool",
+    "trigger_count", "1", "see trigger_ip");
+KNOB<INT32> KnobDumpSignal(KNOB_MODE_WRITEONCE, "pintool",
+    "dump_signal", "0", "flight recorder: dump on this signal, which is "
+    "not delivered to the application");
+KNOB<string> KnobInclude(KNOB_MODE_APPEND, "pintool",
+    "include", "", "trace only this function, image (by file name prefix) "
+    "or address range <lo>-<hi>; all code if not given");
+KNOB<string> KnobExclude(KNOB_MODE_APPEND, "pintool",
+    "exclude", "", "do not trace this function, image or address range, "
+    "logging a summary of the memory it accesses instead");
+KNOB<ADDRINT> KnobStartIp(KNOB_MODE_WRITEONCE, "pintool",
+    "start_ip", "0", "start tracing once the instruction at this address "
+    "has executed start_count times");
+KNOB<UINT64> KnobStartCount(KNOB_MODE_WRITEONCE, "pintool",
+    "start_count", "1", "see start_ip");
+KNOB<UINT64> KnobStartAfter(KNOB_MODE_WRITEONCE, "pintool",
+    "start_after", "0", "start tracing a thread after it has executed this "
+    "many instructions");
+KNOB<ADDRINT> KnobStopIp(KNOB_MODE_WRITEONCE, "pintool",
+    "stop_ip", "0", "end tracing once the instruction at this address is "
+    "about to execute for the stop_count-th time since the start");
+KNOB<UINT64> KnobStopCount(KNOB_MODE_WRITEONCE, "pintool",
+    "stop_count", "1", "see stop_ip");
+KNOB<string> KnobStopAction(KNOB_MODE_WRITEONCE, "pintool",
+    "stop_action", "stop", "at stop_ip: stop, keeping the application "
+    "under Pin without instrumentation, or detach");
+KNOB<UINT64> KnobStopAfter(KNOB_MODE_WRITEONCE, "pintool",
+    "stop_after", "0", "end tracing once a thread has executed this many "
+    "instructions since the start, at a block boundary");
+KNOB<UINT64> KnobSegment(KNOB_MODE_WRITEONCE, "pintool",
+    "segment", "0", "split the traces of every thread into segments of "
+    "<n> million instructions, written to segment.<k>/, 0 for one segment");
+KNOB<UINT32> KnobSegmentsKept(KNOB_MODE_WRITEONCE, "pintool",
+    "segments_kept", "0", "remove the oldest segments of a thread beyond "
+    "the last <n>, 0 to keep them all");
+KNOB<BOOL> KnobLifetimes(KNOB_MODE_WRITEONCE, "pintool",
+    "lifetimes", "1", "log the blocks made live & released by malloc, "
+    "calloc, realloc, free, mmap & munmap, see TRACE_MARKER_ALLOC");
+KNOB<BOOL> KnobRanges(KNOB_MODE_WRITEONCE, "pintool",
+    "ranges", "1", "log rep movs & stos, and calls of memcpy, memmove, "
+    "memset & strcpy, as whole ranges rather than element by element; "
+    "rep movs & stos always are in block mode");
+KNOB<BOOL> KnobImmutable(KNOB_MODE_WRITEONCE, "pintool",
+    "immutable", "1", "log loads from the code & read-only data of the "
+    "loaded images with size 0, see TRACE_FLAG_IMMUTABLE_ELIDED");
+KNOB<BOOL> KnobRecord(KNOB_MODE_WRITEONCE, "pintool",
+    "record", "0", "log only what re-execution cannot reproduce, system "
+    "call results, signals, rdtsc & cpuid, in .trace.replay for -replay");
+KNOB<string> KnobReplay(KNOB_MODE_WRITEONCE, "pintool",
+    "replay", "", "re-execute the run recorded with -record in this "
+    "directory, tracing the window of -start_after & -stop_after");
+KNOB<BOOL> KnobDeps(KNOB_MODE_WRITEONCE, "pintool",
+    "deps", "0", "log the dynamic dependence graph in .trace.deps instead "
+    "of the control & data traces");
 
 /* ===================================================================== */
 
@@ -72,101 +180,2438 @@ static INT32 Usage()
   return -1;
 }
 
+/* ===================================================================== */
+/* Trace Buffers */
+/* ===================================================================== */
+
+// Every thread appends fixed-size records to a private pair of buffers.
+// The recording routines below are straight-line code so that Pin can
+// inline them; a buffer is written out as a whole once it may not hold
+// the records of one more instruction. Each thread writes its own set of
+// trace files, so no lock is taken on the recording path.
+//
+// The buffers of PIN_DefineTraceBuffer are not used: each of them fills
+// & is written out on its own, while the data & control buffers here are
+// flushed together, at instruction or block boundaries only, so that
+// index entries, segments & flight recorder chunks cut both streams at
+// the same point, and pending events are logged in between.
+
+#define MAX_THREADS 64
+
+// upper bound on the bytes one instruction appends to either buffer
+#define INS_SLACK 64
+
+// pending lifetime events kept per thread, later ones are dropped
+#define LIFETIME_EVENTS 4
+
+// room kept for the records of the pending events: a summary of excluded
+// code, LIFETIME_EVENTS lifetime events and a copy
+#define EVENT_SLACK 256
+
+#define BUFFER_SLACK (INS_SLACK + EVENT_SLACK)
+
+struct TraceBuffer
+{
+  char *base;
+  char *cursor;
+  char *limit;
+};
+
+//! @brief buffered memory access, encoded into .trace.data on flush
+struct DataRecord
+{
+  UINT32 addr;
+  UINT32 size;
+  UINT32 slot;
+};
+
+//! @brief control record of an executed block of straight-line code
+struct BlockRecord
+{
+  UINT32 ip;
+  UINT32 count;
+};
+
+//! @brief literal control record or repeat, see "Repeat Coded Control" in
+//         traceformat.hxx
+struct ControlToken
+{
+  UINT32 a;             // ip, or number of tokens repeated
+  UINT32 b;             // instruction count, or number of repetitions
+  BOOL repeat;
+};
+
+// repeats span at most this many tokens, and are searched for in at most
+// this many passes over a chunk, each pass nesting one level deeper
+#define REPEAT_MAX_PERIOD  64
+#define REPEAT_PASSES      3
+
+//! @brief flushed buffers, written out or kept by the flight recorder
+struct TraceChunk
+{
+  UINT8 *data;
+  UINT32 dataSize;
+  char *control;
+  UINT32 controlSize;
+
+  // counts at the end of the chunk
+  UINT64 instructions;
+  UINT64 controlRecords;
+  UINT64 dataRecords;
+
+  // EBP at the end of the chunk, if it ends on an instruction boundary
+  UINT32 framePointer;
+  BOOL indexable;
+};
+
+//! @brief bounding box of memory accesses, empty while low >= high
+struct AccessBox
+{
+  UINT32 low;
+  UINT32 high;
+};
+
+//! @brief block made live or released, see TRACE_MARKER_ALLOC
+struct LifetimeEvent
+{
+  UINT32 marker;
+  UINT32 start;
+  UINT32 size;
+  UINT32 entry;
+  UINT32 defined;
+};
+
+// regions nested deeper in a function are not logged as paths
+#define TRACE_PATH_DEPTH 16
+
+//! @brief region holding a block, and the child of the region it is in
+struct PathLevel
+{
+  UINT32 region;
+  UINT32 child;
+};
+
+//! @brief regions holding a block of the .paths table, function first
+struct PathChain
+{
+  UINT32 address;
+  UINT32 instructions;
+  UINT32 depth;
+  // the regions entered at the block are those from this level on
+  UINT32 entryLevel;
+  PathLevel levels[TRACE_PATH_DEPTH];
+};
+
+//! @brief execution of a region in progress, see "Path Coded Control" in
+//         traceformat.hxx
+struct PathExecution
+{
+  UINT32 region;
+  UINT32 start;         // child entered first
+  UINT32 child;         // child being executed
+  UINT32 sum;           // of the increments from start to child
+  UINT32 flags;         // TRACE_PATH_START & TRACE_PATH_REPEAT
+};
+
+//! @brief regions executed by a call, or by the thread for the outermost
+//         frame
+struct PathFrame
+{
+  UINT32 slot;          // of the return address, ~0 for the thread
+  UINT32 units;         // function regions entered
+  UINT32 depth;
+  PathExecution levels[TRACE_PATH_DEPTH];
+  const PathChain *block;       // being executed, NULL for none
+  UINT32 executed;      // instructions of the block executed
+};
+
+//! @brief marks a point of global order in a per-thread trace, as the
+//         number of control & data records written before it
+struct EpochMarker
+{
+  UINT64 epoch;
+  UINT64 controlRecords;
+  UINT64 dataRecords;
+};
+
+struct ThreadTrace
+{
+  TraceBuffer data;
+  TraceBuffer control;
+  UINT64 instructions;
+  UINT64 controlRecords;
+  UINT64 dataRecords;
+  UINT64 controlBytes;
+  UINT64 dataBytes;
+  UINT64 indexedInstructions;
+  // event records in the control buffer
+  UINT64 markers;
+  TraceSink *dataFile;
+  TraceSink *controlFile;
+  ofstream *epochFile;
+  ofstream *indexFile;
+  TraceHeader dataHeader;
+
+  // instructions executed since the start, for -stop_after
+  UINT64 regionInstructions;
+
+  // segment being written & instructions before it
+  UINT32 segment;
+  UINT64 segmentStart;
+
+  // EBP at the last system call, which ends the trace of a thread that
+  // exits the process
+  UINT32 syscallFramePointer;
+  UINT64 syscallControlRecords;
+
+  // flight recorder: chunks kept in memory until a dump is requested,
+  // after which nothing more is recorded
+  deque<TraceChunk> *ring;
+
+  // the trace ends at the next instruction boundary, by a flight recorder
+  // dump or at the end of the region of interest
+  volatile BOOL endRequested;
+  BOOL stopped;
+
+  // events handled at the next flush check: the end of the trace, the
+  // summary of excluded code or lifetime events
+  volatile BOOL pending;
+
+  // summary of the excluded code run since the last traced instruction,
+  // boxes indexed by IsNearStack
+  BOOL opaque;
+  UINT32 opaqueEntry;
+  UINT32 opaqueFramePointer;
+  UINT32 opaqueStackPointer;
+  AccessBox opaqueWrites[2];
+  AccessBox opaqueReads[2];
+
+  // allocator call in progress: nesting depth, and routine, entry address
+  // & arguments of the outermost call
+  UINT32 allocDepth;
+  UINT32 allocRoutine;
+  UINT32 allocEntry;
+  ADDRINT allocArgs[2];
+
+  // lifetime events not logged yet
+  UINT32 lifetimes;
+  LifetimeEvent lifetime[LIFETIME_EVENTS];
+
+  // copy routine call in progress: nesting depth, and routine, entry
+  // address, ESP & arguments of the outermost call
+  UINT32 copyDepth;
+  UINT32 copyRoutine;
+  UINT32 copyEntry;
+  UINT32 copyStackPointer;
+  ADDRINT copyArgs[3];
+
+  // copy not logged yet, as its TRACE_COPY_RECORDS records
+  BOOL copyPending;
+  DataRecord copy[TRACE_COPY_RECORDS];
+
+  // encoder state: output chunk & last access per slot
+  UINT8 *chunk;
+  UINT32 lastAddr[TRACE_SLOTS];
+  UINT32 lastSize[TRACE_SLOTS];
+  BOOL slotUsed[TRACE_SLOTS];
+  UINT32 usedSlots[TRACE_SLOTS];
+
+  // predicted encoding: accesses after the last one coded per slot, the
+  // context table, and per record the record of the access before it in
+  // its slot & the code that yields this access
+  UINT32 nextAddr[TRACE_SLOTS];
+  UINT32 lastRecord[TRACE_SLOTS];
+  UINT32 runRecord[TRACE_SLOTS];
+  UINT32 fcm[TRACE_FCM_SIZE];
+  vector<UINT32> prevRecord;
+  vector<UINT64> codes;
+
+  // ESP at the start of the thread, within the mapping of its stack
+  ADDRINT startStackPointer;
+
+  // path mode: open region executions by call, innermost call last, and
+  // instructions of the blocks entered since the last flush
+  vector<PathFrame> pathFrames;
+  UINT64 pathInstructions;
+
+  // repeat coder state: output chunk & token lists of the passes
+  UINT8 *controlChunk;
+  vector<ControlToken> tokens[2];
+
+  // block mode: records of the repeated string instruction running, by
+  // offset in the data buffer, the bytes they span, and dataRecords when
+  // they were logged
+  UINT32 repeated[2];
+  UINT32 repeatedSize[2];
+  UINT64 repeatedFlushed;
+};
+
+static ThreadTrace threadTraces[MAX_THREADS];
+static PIN_LOCK traceLock;
+
+// global sequence number shared by the epoch markers of all threads
+static volatile UINT64 epoch;
+
+// log blocks rather than single instructions in .trace.control
+static BOOL blockControl;
+static UINT32 controlRecordSize;
+
+// instruction addresses of every instrumented block, by block address,
+// of every Diablo block of the .paths table in path mode
+static map<ADDRINT, vector<ADDRINT> > blockLayouts;
+
+// log the code of the .paths table as paths of its regions, by chains of
+// its blocks
+static BOOL pathControl;
+static PathTable pathTable;
+static map<ADDRINT, PathChain> pathChains;
+
+static volatile UINT64 triggerCount;
+
+//! @brief region of interest, from -start_* to -stop_*
+enum { ROI_WAITING, ROI_RECORDING, ROI_ENDED };
+static volatile UINT32 roiState;
+static volatile UINT64 startHits, stopHits;
+
+// instructions of a thread before it starts tracing, ~0 if no limit
+static UINT64 startAfter;
+
+//! @brief code selected by -include or -exclude
+struct CodeFilter
+{
+  vector<string> names;
+  vector<pair<ADDRINT, ADDRINT> > ranges;
+};
+
+static CodeFilter includeFilter, excludeFilter;
+
+// copy routines, run as excluded code and logged as TRACE_MARKER_COPY
+static CodeFilter copyFilter;
+
+// sizes of the blocks made live by the allocator, by start address
+static map<ADDRINT, UINT32> liveBlocks;
+
+static VOID
+AllocateBuffer (TraceBuffer *buffer)
+{
+  UINT32 size = KnobBufferSize.Value ();
+  buffer->base = new char[size];
+  buffer->cursor = buffer->base;
+  buffer->limit = buffer->base + size - BUFFER_SLACK;
+}
+
+static VOID
+FreeBuffer (TraceBuffer *buffer)
+{
+  delete [] buffer->base;
+  buffer->base = buffer->cursor = buffer->limit = NULL;
+}
+
+//! @brief encodes the buffered data records as one compact chunk
+//  @return size of the chunk
+static UINT32
+EncodeDataChunk (ThreadTrace *t)
+{
+  UINT8 *p = t->chunk;
+  UINT32 nUsed = 0;
+  DataRecord *r;
+
+  for (r = (DataRecord *) t->data.base; r < (DataRecord *) t->data.cursor;
+       r++)
+    {
+      UINT32 slot = r->slot;
+      UINT32 tag = TRACE_TAG_SAME;
+
+      if (!t->slotUsed[slot])
+	{
+	  t->slotUsed[slot] = true;
+	  t->usedSlots[nUsed++] = slot;
+	}
+      if (r->size != t->lastSize[slot])
+	{
+	  p = TraceEncodeVarint (p, t->lastSize[slot]);
+	  tag = TRACE_TAG_RESIZE;
+	}
+      p = TraceEncodeVarint 
+	(p, (UINT64) TraceZigzag (r->addr - t->lastAddr[slot]) << 2 | tag);
+      t->lastAddr[slot] = r->addr;
+      t->lastSize[slot] = r->size;
+    }
+  UINT32 recordBytes = p - t->chunk;
+
+  for (UINT32 i = 0; i < nUsed; i++)
+    {
+      UINT32 slot = t->usedSlots[i];
+      p = TraceEncodeVarint (p, slot);
+      p = TraceEncodeVarint (p, t->lastAddr[slot]);
+      p = TraceEncodeVarint (p, t->lastSize[slot]);
+      t->lastAddr[slot] = t->lastSize[slot] = 0;
+      t->slotUsed[slot] = false;
+    }
+  UINT32 trailer[3] = { nUsed, recordBytes, 
+			(UINT32) (p - t->chunk) - recordBytes };
+  memcpy (p, trailer, sizeof (trailer));
+  
+  return p + sizeof (trailer) - t->chunk;
+}
+
+#define NO_RECORD  0xffffffffu
+#define NO_CODE    (~0ULL)
+
+//! @brief codes prev, the access of a slot before the last one coded, and
+//         makes it the last one coded. The first access of the slot has
+//         no prev, which is coded as address 0 & never as a hit, so that
+//         the first record of a chunk is never left out.
+//  @return record of prev, see "Predicted Data Encoding"
+static UINT64
+PredictAccess (ThreadTrace *t, UINT32 slot, UINT32 prev, UINT32 size,
+	       BOOL first)
+{
+  UINT32 next1 = t->lastAddr[slot], next2 = t->nextAddr[slot];
+  UINT32 &context = t->fcm[TraceFcmIndex (slot, next1, next2)];
+  UINT64 code;
+
+  if (first)
+    code = (UINT64) TraceZigzag (next1 - prev) << 2 | TRACE_PRED_DELTA;
+  else if (size != t->lastSize[slot])
+    code = (UINT64) TraceZigzag (next1 - prev) << 2 | TRACE_PRED_RESIZE;
+  else if (prev == TraceStride (next1, next2))
+    code = TRACE_PRED_STRIDE;
+  else if (prev == context)
+    code = TRACE_PRED_FCM;
+  else
+    code = (UINT64) TraceZigzag (next1 - prev) << 2 | TRACE_PRED_DELTA;
+
+  context = prev;
+  t->nextAddr[slot] = next1;
+  t->lastAddr[slot] = prev;
+  t->lastSize[slot] = size;
+  return code;
+}
+
+//! @brief encodes the buffered data records as one chunk of predictor hits
+//         & misses
+//  @return size of the chunk
+static UINT32
+EncodeDataPredicted (ThreadTrace *t)
+{
+  DataRecord *r = (DataRecord *) t->data.base;
+  UINT32 n = (DataRecord *) t->data.cursor - r, nUsed = 0, i;
+  UINT8 *p = t->chunk;
+
+  // the record before each one in its slot, and the last one of the slot
+  t->prevRecord.resize (n);
+  for (i = 0; i < n; i++)
+    {
+      UINT32 slot = r[i].slot;
+      if (!t->slotUsed[slot])
+	{
+	  t->slotUsed[slot] = true;
+	  t->usedSlots[nUsed++] = slot;
+	  t->lastRecord[slot] = NO_RECORD;
+	}
+      t->prevRecord[i] = t->lastRecord[slot];
+      t->lastRecord[slot] = i;
+    }
+
+  // code the records backwards, in the order of a reader. A hit is left
+  // out when the next record of its slot is a hit of the same predictor,
+  // which then counts it.
+  t->codes.resize (n);
+  memset (t->fcm, 0, sizeof (t->fcm));
+  for (i = 0; i < nUsed; i++)
+    {
+      UINT32 slot = t->usedSlots[i];
+      t->lastAddr[slot] = t->nextAddr[slot] = r[t->lastRecord[slot]].addr;
+      t->lastSize[slot] = r[t->lastRecord[slot]].size;
+      t->runRecord[slot] = NO_RECORD;
+    }
+  for (i = n; i-- > 0; )
+    {
+      UINT32 slot = r[i].slot, prev = t->prevRecord[i];
+      UINT64 code = prev == NO_RECORD ? 
+	PredictAccess (t, slot, 0, t->lastSize[slot], true) :
+	PredictAccess (t, slot, r[prev].addr, r[prev].size, false);
+      UINT32 run = t->runRecord[slot];
+
+      t->codes[i] = code;
+      t->runRecord[slot] = NO_RECORD;
+      if (code > TRACE_PRED_FCM)
+	continue;
+      if (run != NO_RECORD && (t->codes[run] & 3) == code)
+	{
+	  t->codes[run] += 1 << 2;
+	  t->codes[i] = NO_CODE;
+	  t->runRecord[slot] = run;
+	}
+      else
+	t->runRecord[slot] = i;
+    }
+
+  for (i = 0; i < n; i++)
+    {
+      if (t->codes[i] == NO_CODE)
+	continue;
+      if ((t->codes[i] & 3) == TRACE_PRED_RESIZE)
+	p = TraceEncodeVarint (p, r[t->prevRecord[i]].size);
+      p = TraceEncodeVarint (p, t->codes[i]);
+    }
+  UINT32 recordBytes = p - t->chunk;
+
+  for (i = 0; i < nUsed; i++)
+    {
+      UINT32 slot = t->usedSlots[i];
+      p = TraceEncodeVarint (p, slot);
+      p = TraceEncodeVarint (p, r[t->lastRecord[slot]].addr);
+      p = TraceEncodeVarint (p, r[t->lastRecord[slot]].size);
+      t->slotUsed[slot] = false;
+    }
+  UINT32 trailer[3] = { nUsed, recordBytes, 
+			(UINT32) (p - t->chunk) - recordBytes };
+  memcpy (p, trailer, sizeof (trailer));
+
+  return p + sizeof (trailer) - t->chunk;
+}
+
+//! @brief packs the buffered data records as (address, size) pairs
+//  @return size of the packed records
+static UINT32
+EncodeDataRaw (ThreadTrace *t)
+{
+  UINT32 *p = (UINT32 *) t->chunk;
+  DataRecord *r;
+
+  for (r = (DataRecord *) t->data.base; r < (DataRecord *) t->data.cursor;
+       r++)
+    {
+      *p++ = r->addr;
+      *p++ = r->size;
+    }
+  return (UINT8 *) p - t->chunk;
+}
+
+static inline BOOL
+SameToken (const ControlToken &x, const ControlToken &y)
+{
+  return x.a == y.a && x.b == y.b && x.repeat == y.repeat;
+}
+
+//! @return whether the period tokens at i recur right after them & may
+//          become the body of a repeat, all their repeats within them
+static BOOL
+IsRepeatBody (const vector<ControlToken> &in, UINT32 i, UINT32 period)
+{
+  for (UINT32 j = 0; j < period; j++)
+    if ((in[i + j].repeat && in[i + j].a > j) ||
+	!SameToken (in[i + j], in[i + period + j]))
+      return false;
+  return true;
+}
+
+//! @return whether a repeat at or after position end spans tokens before
+//          it, which folding the tokens up to end would take away
+static BOOL
+SplitsRepeat (const vector<ControlToken> &in, UINT32 end)
+{
+  UINT32 n = min ((UINT32) in.size (), end + REPEAT_MAX_PERIOD);
+
+  for (UINT32 q = end; q < n; q++)
+    if (in[q].repeat && q - in[q].a < end)
+      return true;
+  return false;
+}
+
+//! @brief one greedy pass of the repeat coder: every run of tokens that
+//         immediately recurs becomes the run followed by a repeat, the
+//         shortest run first
+static VOID
+FoldRepeats (const vector<ControlToken> &in, vector<ControlToken> &out)
+{
+  UINT32 n = in.size (), i = 0;
+
+  out.clear ();
+  while (i < n)
+    {
+      UINT32 period, count = 0;
+
+      for (period = 1; period <= REPEAT_MAX_PERIOD && i + 2 * period <= n;
+	   period++)
+	{
+	  if (!SameToken (in[i], in[i + period]) ||
+	      !IsRepeatBody (in, i, period))
+	    continue;
+
+	  // the body recurs at i + period, and maybe further on
+	  count = 1;
+	  while (i + (count + 2) * period <= n &&
+		 equal (in.begin () + i, in.begin () + i + period,
+			in.begin () + i + (count + 1) * period, SameToken))
+	    count++;
+	  while (count != 0 && SplitsRepeat (in, i + (count + 1) * period))
+	    count--;
+	  if (count != 0)
+	    break;
+	}
+      if (count == 0)
+	{
+	  out.push_back (in[i++]);
+	  continue;
+	}
+
+      out.insert (out.end (), in.begin () + i, in.begin () + i + period);
+      ControlToken r = { period, count, true };
+      out.push_back (r);
+      i += (count + 1) * period;
+    }
+}
+
+//! @brief encodes the buffered control records as one repeat coded chunk
+//  @return size of the chunk
+static UINT32
+EncodeControlRepeats (ThreadTrace *t)
+{
+  vector<ControlToken> &tokens = t->tokens[0];
+  UINT8 *p = t->controlChunk;
+  UINT32 lastIp = 0;
+
+  tokens.clear ();
+  for (char *r = t->control.base; r < t->control.cursor; 
+       r += controlRecordSize)
+    {
+      ControlToken literal = { 0, 0, false };
+      if (blockControl)
+	{
+	  literal.a = ((BlockRecord *) r)->ip;
+	  literal.b = ((BlockRecord *) r)->count;
+	}
+      else
+	literal.a = (UINT32) *(ADDRINT *) r;
+      tokens.push_back (literal);
+    }
+
+  for (UINT32 pass = 0; pass < REPEAT_PASSES; pass++)
+    {
+      FoldRepeats (tokens, t->tokens[1]);
+      BOOL shrunk = t->tokens[1].size () < tokens.size ();
+      tokens.swap (t->tokens[1]);
+      if (!shrunk)
+	break;
+    }
+
+  for (UINT32 i = 0; i < tokens.size (); i++)
+    if (tokens[i].repeat)
+      {
+	p = TraceEncodeVarint (p, (UINT64) tokens[i].a << 1 | 1);
+	p = TraceEncodeVarint (p, tokens[i].b);
+      }
+    else
+      {
+	p = TraceEncodeVarint
+	  (p, (UINT64) TraceZigzag (tokens[i].a - lastIp) << 1);
+	if (blockControl)
+	  p = TraceEncodeVarint (p, tokens[i].b);
+	lastIp = tokens[i].a;
+      }
+  UINT32 tokenBytes = p - t->controlChunk;
+  memcpy (p, &tokenBytes, sizeof (tokenBytes));
+
+  return tokenBytes + TRACE_REPEAT_TRAILER;
+}
+
+//! @brief checks for room for the dataBytes of records of the next 
+//         instruction, or block in block mode. Also true when events are
+//         pending, which are handled by FlushBuffersAt.
+static ADDRINT
+BuffersFull (THREADID tid, UINT32 dataBytes)
+{
+  ThreadTrace *t = &threadTraces[tid];
+  return (t->data.cursor + dataBytes > t->data.limit + INS_SLACK) | 
+    (t->control.cursor > t->control.limit) | t->pending;
+}
+
+//! @brief BuffersFull at the first iteration of a block head repeated by
+//         a prefix, whose later iterations are still in the same block
+static ADDRINT
+BuffersFullOnce (BOOL first, THREADID tid, UINT32 dataBytes)
+{
+  return first && BuffersFull (tid, dataBytes);
+}
+
+//! @brief appends a chunk to the trace files & indexes its end
+static VOID
+WriteChunk (ThreadTrace *t, TraceChunk *c)
+{
+  TraceIndexEntry entry;
+
+  t->dataFile->Write (c->data, c->dataSize);
+  t->dataBytes += c->dataSize;
+  t->controlFile->Write (c->control, c->controlSize);
+  t->controlBytes += c->controlSize;
+
+  if (!c->indexable || 
+      c->instructions - t->indexedInstructions < KnobIndex.Value ())
+    return;
+
+  memset (&entry, 0, sizeof (entry));
+  entry.instructions = c->instructions;
+  entry.controlRecords = c->controlRecords;
+  entry.dataRecords = c->dataRecords;
+  entry.controlOffset = t->controlBytes;
+  entry.dataOffset = t->dataBytes;
+  entry.framePointer = c->framePointer;
+  t->indexFile->write ((char *) &entry, sizeof (entry));
+  t->indexedInstructions = c->instructions;
+}
+
+//! @brief keeps a copy of a chunk in the flight recorder, dropping the
+//         oldest chunks not needed to cover the last KnobRing million
+//         instructions
+static VOID
+RingPush (ThreadTrace *t, TraceChunk *c)
+{
+  TraceChunk copy = *c;
+  UINT64 limit = KnobRing.Value () * 1000000;
+
+  copy.data = new UINT8[c->dataSize];
+  memcpy (copy.data, c->data, c->dataSize);
+  copy.control = new char[c->controlSize];
+  memcpy (copy.control, c->control, c->controlSize);
+  t->ring->push_back (copy);
+
+  while (t->ring->size () > 1 && 
+	 t->instructions - t->ring->front ().instructions >= limit)
+    {
+      TraceChunk *oldest = &t->ring->front ();
+      t->dataHeader.firstInstruction = oldest->instructions;
+      t->dataHeader.firstControlRecord = oldest->controlRecords;
+      t->dataHeader.firstDataRecord = oldest->dataRecords;
+      delete [] oldest->data;
+      delete [] oldest->control;
+      t->ring->pop_front ();
+    }
+}
+
+static VOID
+FlushBuffers (THREADID tid, ADDRINT framePointer, BOOL indexable)
+{
+  ThreadTrace *t = &threadTraces[tid];
+  TraceChunk c;
+
+  c.data = t->chunk;
+  c.dataSize = 0;
+  if (t->data.cursor != t->data.base)
+    c.dataSize = !KnobCompact ? EncodeDataRaw (t) :
+      KnobPredict ? EncodeDataPredicted (t) : EncodeDataChunk (t);
+  c.control = t->control.base;
+  c.controlSize = t->control.cursor - t->control.base;
+  if (KnobRepeats && c.controlSize != 0)
+    {
+      c.controlSize = EncodeControlRepeats (t);
+      c.control = (char *) t->controlChunk;
+    }
+  UINT64 controlRecords = 
+    (t->control.cursor - t->control.base) / controlRecordSize;
+
+  // instructions run before the region of interest have no records
+  if (t->controlRecords == 0 && controlRecords != 0 && t->instructions != 0)
+    {
+      t->dataHeader.firstInstruction = t->instructions;
+      t->dataHeader.flags |= TRACE_FLAG_TRUNCATED;
+      t->dataHeader.flags &= ~TRACE_FLAG_REGISTERS;
+    }
+
+  t->dataRecords += 
+    (t->data.cursor - t->data.base) / sizeof (DataRecord);
+  t->controlRecords += controlRecords;
+  if (pathControl)
+    {
+      // blocks are counted as they are entered
+      t->instructions += t->pathInstructions;
+      t->pathInstructions = 0;
+    }
+  else if (blockControl)
+    {
+      BlockRecord *b;
+      for (b = (BlockRecord *) t->control.base; 
+	   b < (BlockRecord *) t->control.cursor; b++)
+	t->instructions += b->count;
+    }
+  else
+    t->instructions += controlRecords - t->markers;
+  t->markers = 0;
+
+  c.instructions = t->instructions;
+  c.controlRecords = t->controlRecords;
+  c.dataRecords = t->dataRecords;
+  c.framePointer = framePointer;
+  c.indexable = indexable;
+
+  // a dumped flight recorder records nothing more
+  if (t->ring)
+    RingPush (t, &c);
+  else if (!t->stopped)
+    WriteChunk (t, &c);
+
+  t->data.cursor = t->data.base;
+  t->control.cursor = t->control.base;
+}
+
+static VOID OpenTraceFiles (THREADID tid);
+static VOID CloseTraceFiles (THREADID tid);
+static string SegmentDirectory (UINT32 segment);
+static string SegmentFileName (const char *stream, THREADID tid, 
+			       UINT32 segment);
+
+//! @brief stores the registers of ctxt in a trace header
+static VOID
+SnapshotRegisters (TraceHeader *header, const CONTEXT *ctxt)
+{
+  static const REG regs[TRACE_REGISTERS] = 
+    { REG_EAX, REG_ECX, REG_EDX, REG_EBX, REG_ESP, REG_EBP, REG_ESI, 
+      REG_EDI, REG_EFLAGS };
+
+  for (UINT32 i = 0; i < TRACE_REGISTERS; i++)
+    header->registers[i] = PIN_GetContextReg (ctxt, regs[i]);
+  header->flags |= TRACE_FLAG_REGISTERS;
+}
+
+//! @brief stores in the data header the start of the mapping holding the
+//         stack of the thread, as it is now: the stack of the main thread
+//         grows within its mapping, the slicer drops no cells below it
+static VOID
+SnapshotStackLimit (ThreadTrace *t)
+{
+  ifstream maps ("/proc/self/maps");
+  string line;
+
+  while (getline (maps, line))
+    {
+      istringstream range (line);
+      unsigned long start, end;
+      char dash;
+
+      if (range >> hex >> start >> dash >> end &&
+	  start <= t->startStackPointer && t->startStackPointer < end)
+	{
+	  t->dataHeader.stackLimit = start;
+	  t->dataHeader.flags |= TRACE_FLAG_STACK_LIMIT;
+	  return;
+	}
+    }
+}
+
+//! @brief closes the segment being written at the current position and
+//         opens the next one, which starts with the registers of ctxt
+static VOID
+NextSegment (THREADID tid, ADDRINT framePointer, const CONTEXT *ctxt)
+{
+  ThreadTrace *t = &threadTraces[tid];
+  TraceHeader *header = &t->dataHeader;
+
+  header->framePointer = framePointer;
+  header->flags |= TRACE_FLAG_FRAME_POINTER;
+  SnapshotStackLimit (t);
+  t->dataFile->Patch (0, header, sizeof (*header));
+  CloseTraceFiles (tid);
+
+  // age out the oldest segment kept
+  if (KnobSegmentsKept && t->segment + 1 >= KnobSegmentsKept)
+    {
+      UINT32 oldest = t->segment + 1 - KnobSegmentsKept;
+      const char *streams[] = { "data", "control", "index" };
+      for (UINT32 i = 0; i < 3; i++)
+	unlink (SegmentFileName (streams[i], tid, oldest).c_str ());
+      // left to the last thread done with the segment
+      rmdir (SegmentDirectory (oldest).c_str ());
+    }
+
+  header->segment = ++t->segment;
+  header->firstInstruction = t->segmentStart = t->instructions;
+  header->firstControlRecord = t->controlRecords;
+  header->firstDataRecord = t->dataRecords;
+  header->flags = (header->flags & (TRACE_FLAG_STATIC_ELIDED |
+				    TRACE_FLAG_STACK_POINTER |
+				    TRACE_FLAG_IMMUTABLE_ELIDED)) |
+    TRACE_FLAG_TRUNCATED;
+  header->framePointer = 0;
+  SnapshotRegisters (header, ctxt);
+  OpenTraceFiles (tid);
+}
+
+//! @brief writes out the flight recorder, ending the trace of the thread
+//         at the current position
+static VOID
+DumpRing (THREADID tid, ADDRINT framePointer, BOOL framePointerKnown)
+{
+  ThreadTrace *t = &threadTraces[tid];
+  deque<TraceChunk>::iterator iter;
+
+  if (t->ring == NULL)
+    return;
+
+  if (t->dataHeader.firstInstruction != 0)
+    {
+      t->dataHeader.flags |= TRACE_FLAG_TRUNCATED;
+      t->dataHeader.flags &= ~TRACE_FLAG_REGISTERS;
+    }
+  if (framePointerKnown)
+    {
+      t->dataHeader.framePointer = framePointer;
+      t->dataHeader.flags |= TRACE_FLAG_FRAME_POINTER;
+    }
+  SnapshotStackLimit (t);
+  OpenTraceFiles (tid);
+
+  for (iter = t->ring->begin (); iter != t->ring->end (); iter++)
+    {
+      WriteChunk (t, &*iter);
+      delete [] iter->data;
+      delete [] iter->control;
+    }
+  delete t->ring;
+  t->ring = NULL;
+  t->stopped = true;
+}
+
+static VOID RecordOpaque (THREADID tid);
+static VOID RecordLifetimes (THREADID tid);
+static VOID RecordCopy (THREADID tid);
+static VOID EndPathBlock (THREADID tid, UINT32 executed);
+static VOID ClosePaths (THREADID tid);
+
+//! @brief ends the trace of a thread at an instruction boundary, by
+//         writing out its flight recorder or completing its header
+static VOID
+EndTrace (THREADID tid, ADDRINT framePointer)
+{
+  ThreadTrace *t = &threadTraces[tid];
+
+  if (pathControl)
+    ClosePaths (tid);
+  FlushBuffers (tid, framePointer, true);
+  if (t->ring)
+    DumpRing (tid, framePointer, true);
+  else if (!t->stopped)
+    {
+      t->dataHeader.framePointer = framePointer;
+      t->dataHeader.flags |= TRACE_FLAG_FRAME_POINTER;
+      SnapshotStackLimit (t);
+      t->dataFile->Patch (0, &t->dataHeader, sizeof (t->dataHeader));
+      t->stopped = true;
+    }
+}
+
+//! @brief flushes on the way into an instruction, or a block in block
+//         mode, where both streams are in step and may be indexed, and
+//         handles pending events
+static VOID
+FlushBuffersAt (THREADID tid, ADDRINT framePointer, UINT32 dataBytes,
+		const CONTEXT *ctxt)
+{
+  ThreadTrace *t = &threadTraces[tid];
+
+  t->pending = false;
+  if (t->data.cursor + dataBytes > t->data.limit + INS_SLACK ||
+      t->control.cursor > t->control.limit)
+    {
+      FlushBuffers (tid, framePointer, true);
+      if (KnobSegment && !t->stopped && 
+	  t->instructions - t->segmentStart >= KnobSegment * 1000000)
+	NextSegment (tid, framePointer, ctxt);
+    }
+
+  // the block entered does not run in the trace, and the executions up
+  // to it are logged before the events, as at the entry of any block
+  if (t->endRequested && pathControl)
+    {
+      EndPathBlock (tid, 0);
+      ClosePaths (tid);
+    }
+
+  // the buffers keep room for the events beyond the next instruction.
+  // Lifetime events go before the summary of excluded code, which may
+  // have run after them and is then met first by a backward scan
+  if (t->lifetimes)
+    RecordLifetimes (tid);
+  if (t->copyPending)
+    RecordCopy (tid);
+  if (t->opaque)
+    RecordOpaque (tid);
+
+  if (t->endRequested)
+    {
+      t->endRequested = false;
+      EndTrace (tid, framePointer);
+    }
+}
+
+//! @brief asks all threads to dump their flight recorders at their next
+//         instruction boundary
+static VOID
+RequestDump ()
+{
+  for (THREADID tid = 0; tid < MAX_THREADS; tid++)
+    if (threadTraces[tid].ring)
+      {
+	threadTraces[tid].endRequested = true;
+	threadTraces[tid].pending = true;
+      }
+}
+
+static VOID
+CountTrigger ()
+{
+  if (__sync_add_and_fetch (&triggerCount, 1) == KnobTriggerCount.Value ())
+    RequestDump ();
+}
+
+//! @brief tags the current position of both streams with a global epoch
+static VOID
+RecordEpoch (THREADID tid)
+{
+  ThreadTrace *t = &threadTraces[tid];
+  EpochMarker marker;
+
+  marker.epoch = __sync_fetch_and_add (&epoch, 1);
+  marker.controlRecords = t->controlRecords + 
+    (t->control.cursor - t->control.base) / controlRecordSize;
+  marker.dataRecords = t->dataRecords + 
+    (t->data.cursor - t->data.base) / sizeof (DataRecord);
+  t->epochFile->write ((char *) &marker, sizeof (marker));
+}
+
+static VOID
+InitHeader (TraceHeader *header, UINT32 stream, UINT32 encoding, 
+	    THREADID tid)
+{
+  memset (header, 0, sizeof (*header));
+  header->magic = TRACE_MAGIC;
+  header->version = TRACE_VERSION;
+  header->stream = stream;
+  header->encoding = encoding;
+  header->thread = tid;
+}
+
+//! @return name of a trace file, suffixed by the thread id for all but
+//          the main thread
+static string
+TraceFileName (const char *stream, THREADID tid)
+{
+  stringstream fileName;
+
+  fileName << ".trace." << stream;
+  if (tid != 0)
+    fileName << "." << tid;
+  return fileName.str ();
+}
+
+static string
+SegmentDirectory (UINT32 segment)
+{
+  stringstream directory;
+
+  directory << "segment." << segment;
+  return directory.str ();
+}
+
+//! @return name of a trace file of a segment, in a directory of its own
+//          when the output is split, so that it reads as a whole trace
+static string
+SegmentFileName (const char *stream, THREADID tid, UINT32 segment)
+{
+  if (!KnobSegment)
+    return TraceFileName (stream, tid);
+  return SegmentDirectory (segment) + "/" + TraceFileName (stream, tid);
+}
+
+static VOID 
+RecordMem (THREADID tid, ADDRINT addr, UINT32 size, UINT32 slot)
+{
+  DataRecord *r = (DataRecord *) threadTraces[tid].data.cursor;
+  
+  r->addr = (UINT32) addr;
+  r->size = size;
+  r->slot = slot;
+  threadTraces[tid].data.cursor = (char *) (r + 1);
+}
+
+/* ===================================================================== */
+/* Immutable Memory */
+/* ===================================================================== */
+
+// A bit per page of the address space, set for the pages that only hold
+// code or read-only data of the loaded images, see MarkImmutable. Loads
+// from them still log a record, keeping the records of an instruction in
+// step with the slicer, but with size 0, which it never explains. The
+// address is kept, so that the deltas of the slot stay small.
+#define IMMUTABLE_PAGE_SHIFT  12
+static UINT32 immutablePages[1 << (32 - IMMUTABLE_PAGE_SHIFT - 5)];
+
+static inline BOOL
+IsImmutablePage (ADDRINT addr)
+{
+  UINT32 page = (UINT32) addr >> IMMUTABLE_PAGE_SHIFT;
+  return (immutablePages[page >> 5] >> (page & 31)) & 1;
+}
+
+//! @return true if all pages of the size bytes from addr on are immutable
+static BOOL
+IsImmutable (ADDRINT addr, UINT32 size)
+{
+  ADDRINT last = addr + size - 1;
+
+  for (; addr >> IMMUTABLE_PAGE_SHIFT < last >> IMMUTABLE_PAGE_SHIFT;
+       addr += 1 << IMMUTABLE_PAGE_SHIFT)
+    if (!IsImmutablePage (addr))
+      return false;
+  return IsImmutablePage (last);
+}
+
+//! @brief logs a load, with size 0 from immutable memory. A single load
+//         spans at most two pages, both tested without a branch, so that
+//         Pin can inline the call; ranges go through IsImmutable.
 static VOID 
-RecordMem(VOID * ip, CHAR r, VOID * addr, INT32 size, 
-	  BOOL isPrefetch)
+RecordLoad (THREADID tid, ADDRINT addr, UINT32 size, UINT32 slot)
+{
+  UINT32 immutable = 
+    IsImmutablePage (addr) & IsImmutablePage (addr + size - 1);
+
+  RecordMem (tid, addr, size & (immutable - 1), slot);
+}
+
+static VOID
+RecordControlPred (THREADID tid, VOID *ip)
+{
+  char *cursor = threadTraces[tid].control.cursor;
+
+  *(VOID **) cursor = ip;
+  threadTraces[tid].control.cursor = cursor + sizeof (ip);
+}
+
+static VOID
+RecordBlock (THREADID tid, UINT32 ip, UINT32 count)
+{
+  BlockRecord *b = (BlockRecord *) threadTraces[tid].control.cursor;
+
+  b->ip = ip;
+  b->count = count;
+  threadTraces[tid].control.cursor = (char *) (b + 1);
+}
+
+//! @brief ends the last logged block at instruction ip, including the
+//         following extra instructions
+static VOID
+TruncateBlock (THREADID tid, ADDRINT ip, UINT32 extra)
+{
+  ThreadTrace *t = &threadTraces[tid];
+
+  if (pathControl)
+    {
+      PathFrame *f = &t->pathFrames.back ();
+      if (f->block == NULL)
+	return;
+      GetLock (&traceLock, tid + 1);
+      vector<ADDRINT> &layout = blockLayouts[f->block->address];
+      for (UINT32 i = 0; i < layout.size (); i++)
+	if (layout[i] == ip)
+	  EndPathBlock (tid, i + extra);
+      ReleaseLock (&traceLock);
+      return;
+    }
+
+  if (t->control.cursor == t->control.base)
+    return;
+  BlockRecord *b = (BlockRecord *) t->control.cursor - 1;
+  GetLock (&traceLock, tid + 1);
+  vector<ADDRINT> &layout = blockLayouts[b->ip];
+  for (UINT32 i = 0; i < layout.size (); i++)
+    if (layout[i] == ip)
+      b->count = i + extra;
+  ReleaseLock (&traceLock);
+
+  if (b->count == 0)
+    t->control.cursor = (char *) b;
+}
+
+//! @return 1 for addresses at most 1MB below the stack pointer at the
+//          entry of excluded code, or above it; 0 for others
+static UINT32
+IsNearStack (ThreadTrace *t, UINT32 addr)
+{
+  return addr + 0x100000 >= t->opaqueStackPointer;
+}
+
+//! @brief starts a summary on entry of excluded code
+static VOID
+OpaqueEnter (THREADID tid, ADDRINT ip, ADDRINT framePointer, 
+	     ADDRINT stackPointer)
+{
+  ThreadTrace *t = &threadTraces[tid];
+
+  if (t->opaque)
+    return;
+  t->opaque = true;
+  t->opaqueEntry = ip;
+  t->opaqueFramePointer = framePointer;
+  t->opaqueStackPointer = stackPointer;
+  for (UINT32 i = 0; i < 2; i++)
+    {
+      t->opaqueWrites[i].low = t->opaqueReads[i].low = ~0U;
+      t->opaqueWrites[i].high = t->opaqueReads[i].high = 0;
+    }
+  t->pending = true;
+}
+
+static VOID
+ExtendBox (AccessBox *box, UINT32 addr, UINT32 size)
+{
+  box->low = addr < box->low ? addr : box->low;
+  box->high = addr + size > box->high ? addr + size : box->high;
+}
+
+static VOID
+OpaqueRead (THREADID tid, ADDRINT addr, UINT32 size)
+{
+  ThreadTrace *t = &threadTraces[tid];
+  if (!IsImmutable (addr, size))
+    ExtendBox (&t->opaqueReads[IsNearStack (t, addr)], addr, size);
+}
+
+static VOID
+OpaqueWrite (THREADID tid, ADDRINT addr, UINT32 size)
+{
+  ThreadTrace *t = &threadTraces[tid];
+  ExtendBox (&t->opaqueWrites[IsNearStack (t, addr)], addr, size);
+}
+
+//! @brief logs the summary of the excluded code run since the last traced
+//         instruction as a TRACE_MARKER_OPAQUE event
+static VOID
+RecordOpaque (THREADID tid)
+{
+  ThreadTrace *t = &threadTraces[tid];
+  DataRecord *r = (DataRecord *) t->data.cursor;
+  AccessBox *boxes[4] = { &t->opaqueWrites[1], &t->opaqueWrites[0], 
+			  &t->opaqueReads[1], &t->opaqueReads[0] };
+
+  r->addr = t->opaqueEntry;
+  r->size = t->opaqueFramePointer;
+  r->slot = TraceSlot (TRACE_MARKER_OPAQUE, 0);
+  for (UINT32 k = 1; k < TRACE_OPAQUE_RECORDS; k++)
+    {
+      AccessBox *box = boxes[k - 1];
+      r++;
+      r->addr = box->low < box->high ? box->low : 0;
+      r->size = box->low < box->high ? box->high - box->low : 0;
+      r->slot = TraceSlot (TRACE_MARKER_OPAQUE, k);
+    }
+  t->data.cursor = (char *) (r + 1);
+
+  if (blockControl)
+    RecordBlock (tid, TRACE_MARKER_OPAQUE, 0);
+  else
+    RecordControlPred (tid, (VOID *) TRACE_MARKER_OPAQUE);
+  t->markers++;
+  t->opaque = false;
+}
+
+/* ===================================================================== */
+/* Allocation Lifetimes */
+/* ===================================================================== */
+
+// Calls of the allocator are logged as TRACE_MARKER_ALLOC & _FREE events
+// once they return, so that the slicer knows no older instruction defines
+// the bytes of a fresh block. Only the outermost of nested calls, as a
+// calloc calling malloc, is logged.
+
+enum
+{
+  ALLOC_MALLOC, ALLOC_CALLOC, ALLOC_REALLOC, ALLOC_FREE, ALLOC_MMAP, 
+  ALLOC_MUNMAP
+};
+
+static const char *allocRoutines[] = 
+  { "malloc", "calloc", "realloc", "free", "mmap", "munmap" };
+
+//! @brief queues a lifetime event, logged at the next flush check. Events
+//         beyond LIFETIME_EVENTS are dropped, which only leaves the slicer
+//         more to explain.
+static VOID
+PushLifetime (ThreadTrace *t, UINT32 marker, UINT32 start, UINT32 size,
+	      UINT32 defined)
+{
+  if (size == 0 || t->stopped || t->lifetimes == LIFETIME_EVENTS)
+    return;
+
+  LifetimeEvent *e = &t->lifetime[t->lifetimes++];
+  e->marker = marker;
+  e->start = start;
+  e->size = size;
+  e->entry = t->allocEntry;
+  e->defined = defined;
+  t->pending = true;
+}
+
+//! @brief forgets a block released by the allocator
+//  @return size of the block, 0 if it is unknown
+static UINT32
+ForgetBlock (THREADID tid, ADDRINT start)
+{
+  UINT32 size = 0;
+
+  GetLock (&traceLock, tid + 1);
+  map<ADDRINT, UINT32>::iterator block = liveBlocks.find (start);
+  if (block != liveBlocks.end ())
+    {
+      size = block->second;
+      liveBlocks.erase (block);
+    }
+  ReleaseLock (&traceLock);
+  return size;
+}
+
+static VOID
+RememberBlock (THREADID tid, ADDRINT start, UINT32 size)
+{
+  GetLock (&traceLock, tid + 1);
+  liveBlocks[start] = size;
+  ReleaseLock (&traceLock);
+}
+
+static VOID
+AllocEnter (THREADID tid, UINT32 routine, ADDRINT entry, ADDRINT arg0,
+	    ADDRINT arg1)
+{
+  ThreadTrace *t = &threadTraces[tid];
+
+  if (t->allocDepth++ != 0)
+    return;
+  t->allocRoutine = routine;
+  t->allocEntry = entry;
+  t->allocArgs[0] = arg0;
+  t->allocArgs[1] = arg1;
+}
+
+static VOID
+AllocExit (THREADID tid, ADDRINT result)
+{
+  ThreadTrace *t = &threadTraces[tid];
+  ADDRINT *args = t->allocArgs;
+
+  // a return without its entry, when tracing started inside the allocator
+  if (t->allocDepth == 0 || --t->allocDepth != 0)
+    return;
+
+  switch (t->allocRoutine)
+    {
+    case ALLOC_MALLOC:
+    case ALLOC_CALLOC:
+      {
+	UINT32 size = t->allocRoutine == ALLOC_MALLOC ? 
+	  args[0] : args[0] * args[1];
+	if (result == 0)
+	  break;
+	RememberBlock (tid, result, size);
+	PushLifetime (t, TRACE_MARKER_ALLOC, result, size, 
+		      t->allocRoutine == ALLOC_CALLOC);
+	break;
+      }
+
+    case ALLOC_REALLOC:
+      {
+	// realloc (0, n) is malloc (n), realloc (p, 0) may be free (p). The
+	// bytes kept from the old block are defined by the copy, within
+	// realloc; with the old size unknown, none are taken as fresh
+	UINT32 size = args[1];
+	UINT32 kept = args[0] ? ForgetBlock (tid, args[0]) : 0;
+	BOOL known = args[0] == 0 || kept != 0;
+
+	if (result == 0)
+	  {
+	    if (size != 0 && kept)
+	      RememberBlock (tid, args[0], kept);
+	    else
+	      PushLifetime (t, TRACE_MARKER_FREE, args[0], kept, 0);
+	    break;
+	  }
+	if (result != args[0])
+	  PushLifetime (t, TRACE_MARKER_FREE, args[0], kept, 0);
+	RememberBlock (tid, result, size);
+	if (known && kept < size)
+	  PushLifetime (t, TRACE_MARKER_ALLOC, result + kept, size - kept, 0);
+	break;
+      }
+
+    case ALLOC_FREE:
+      if (args[0])
+	PushLifetime (t, TRACE_MARKER_FREE, args[0], 
+		      ForgetBlock (tid, args[0]), 0);
+      break;
+
+    case ALLOC_MMAP:
+      if (result != (ADDRINT) -1)
+	PushLifetime (t, TRACE_MARKER_ALLOC, result, args[1], 1);
+      break;
+
+    case ALLOC_MUNMAP:
+      if (result == 0)
+	PushLifetime (t, TRACE_MARKER_FREE, args[0], args[1], 0);
+      break;
+    }
+}
+
+//! @brief logs the pending lifetime events, see TRACE_MARKER_ALLOC
+static VOID
+RecordLifetimes (THREADID tid)
+{
+  ThreadTrace *t = &threadTraces[tid];
+
+  for (UINT32 i = 0; i < t->lifetimes; i++)
+    {
+      LifetimeEvent *e = &t->lifetime[i];
+      DataRecord *r = (DataRecord *) t->data.cursor;
+
+      r[0].addr = e->start;
+      r[0].size = e->size;
+      r[0].slot = TraceSlot (e->marker, 0);
+      r[1].addr = e->entry;
+      r[1].size = e->defined;
+      r[1].slot = TraceSlot (e->marker, 1);
+      t->data.cursor = (char *) (r + TRACE_LIFETIME_RECORDS);
+
+      if (blockControl)
+	RecordBlock (tid, e->marker, 0);
+      else
+	RecordControlPred (tid, (VOID *) (ADDRINT) e->marker);
+      t->markers++;
+    }
+  t->lifetimes = 0;
+}
+
+//! @brief instruments the allocator routines an image defines
+static VOID
+InstrumentAllocator (IMG img)
+{
+  for (UINT32 routine = 0; 
+       routine < sizeof (allocRoutines) / sizeof (allocRoutines[0]); 
+       routine++)
+    {
+      RTN rtn = RTN_FindByName (img, allocRoutines[routine]);
+      if (!RTN_Valid (rtn))
+	continue;
+
+      RTN_Open (rtn);
+      RTN_InsertCall (rtn, IPOINT_BEFORE, (AFUNPTR) AllocEnter,
+		      IARG_THREAD_ID, IARG_UINT32, routine,
+		      IARG_ADDRINT, RTN_Address (rtn),
+		      IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+		      IARG_FUNCARG_ENTRYPOINT_VALUE, 1, IARG_END);
+      RTN_InsertCall (rtn, IPOINT_AFTER, (AFUNPTR) AllocExit,
+		      IARG_THREAD_ID, IARG_FUNCRET_EXITPOINT_VALUE, 
+		      IARG_END);
+      RTN_Close (rtn);
+    }
+}
+
+/* ===================================================================== */
+/* Copy Routines */
+/* ===================================================================== */
+
+// memcpy, memmove, memset & strcpy, and their variants named __<name>_*,
+// run as excluded code. A call that returns its destination, as these
+// do, is logged as a TRACE_MARKER_COPY event in place of the summary of
+// the routine; others, such as the resolver of an indirect function
+// named memcpy, keep their summary.
+
+enum { COPY_MEMCPY, COPY_MEMMOVE, COPY_MEMSET, COPY_STRCPY };
+
+static const char *copyRoutines[] = 
+  { "memcpy", "memmove", "memset", "strcpy" };
+
+//! @return the copy routine named name, or ~0U
+static UINT32
+FindCopyRoutine (const string &name)
+{
+  for (UINT32 routine = 0; 
+       routine < sizeof (copyRoutines) / sizeof (copyRoutines[0]); 
+       routine++)
+    {
+      string prefix = string ("__") + copyRoutines[routine] + "_";
+      if (name == copyRoutines[routine] || 
+	  name.compare (0, prefix.size (), prefix) == 0)
+	return routine;
+    }
+  return ~0U;
+}
+
+static VOID
+CopyEnter (THREADID tid, UINT32 routine, ADDRINT entry, ADDRINT stackPointer,
+	   ADDRINT arg0, ADDRINT arg1, ADDRINT arg2)
+{
+  ThreadTrace *t = &threadTraces[tid];
+
+  if (t->copyDepth++ != 0)
+    return;
+  t->copyRoutine = routine;
+  t->copyEntry = entry;
+  t->copyStackPointer = stackPointer;
+  t->copyArgs[0] = arg0;
+  t->copyArgs[1] = arg1;
+  t->copyArgs[2] = arg2;
+}
+
+//! @return length of the string at addr, including its terminator
+static UINT32
+StringSize (ADDRINT addr)
+{
+  char buffer[256];
+  UINT32 size = 0;
+
+  for (;;)
+    {
+      size_t n = PIN_SafeCopy (buffer, (VOID *) (addr + size), 
+			       sizeof (buffer));
+      VOID *end = memchr (buffer, 0, n);
+      if (end)
+	return size + ((char *) end - buffer) + 1;
+      if (n < sizeof (buffer))
+	return size + n;
+      size += n;
+    }
+}
+
+static VOID
+CopyExit (THREADID tid, ADDRINT result)
+{
+  ThreadTrace *t = &threadTraces[tid];
+  ADDRINT *args = t->copyArgs;
+  DataRecord *r = t->copy;
+
+  if (t->copyDepth == 0 || --t->copyDepth != 0 || t->stopped ||
+      result != args[0])
+    return;
+
+  UINT32 size = t->copyRoutine == COPY_STRCPY ? 
+    StringSize (args[0]) : args[2];
+  BOOL source = t->copyRoutine != COPY_MEMSET;
+  UINT32 argBytes = t->copyRoutine == COPY_STRCPY ? 8 : 12;
+
+  r[0].addr = args[0];
+  r[0].size = size;
+  r[1].addr = source ? args[1] : 0;
+  r[1].size = source ? size : 0;
+  r[2].addr = t->copyStackPointer + 4;
+  r[2].size = argBytes;
+  r[3].addr = t->copyEntry;
+  r[3].size = 0;
+  for (UINT32 k = 0; k < TRACE_COPY_RECORDS; k++)
+    r[k].slot = TraceSlot (TRACE_MARKER_COPY, k);
+  t->copyPending = true;
+  t->pending = true;
+
+  // the event stands for the summary of a routine called by traced code
+  if (t->opaque && t->opaqueEntry == t->copyEntry)
+    t->opaque = false;
+}
+
+//! @brief logs the pending copy, see TRACE_MARKER_COPY
+static VOID
+RecordCopy (THREADID tid)
+{
+  ThreadTrace *t = &threadTraces[tid];
+
+  memcpy (t->data.cursor, t->copy, sizeof (t->copy));
+  t->data.cursor += sizeof (t->copy);
+  if (blockControl)
+    RecordBlock (tid, TRACE_MARKER_COPY, 0);
+  else
+    RecordControlPred (tid, (VOID *) TRACE_MARKER_COPY);
+  t->markers++;
+  t->copyPending = false;
+}
+
+//! @brief runs the copy routines of an image as excluded code, and
+//         instruments their calls
+static VOID
+InstrumentCopies (IMG img)
+{
+  for (SEC sec = IMG_SecHead (img); SEC_Valid (sec); sec = SEC_Next (sec))
+    for (RTN rtn = SEC_RtnHead (sec); RTN_Valid (rtn); rtn = RTN_Next (rtn))
+      {
+	UINT32 routine = FindCopyRoutine (RTN_Name (rtn));
+	if (routine == ~0U)
+	  continue;
+
+	GetLock (&traceLock, PIN_ThreadId () + 1);
+	copyFilter.ranges.push_back (make_pair (RTN_Address (rtn),
+						RTN_Address (rtn) + 
+						RTN_Size (rtn)));
+	ReleaseLock (&traceLock);
+
+	RTN_Open (rtn);
+	RTN_InsertCall (rtn, IPOINT_BEFORE, (AFUNPTR) CopyEnter,
+			IARG_THREAD_ID, IARG_UINT32, routine,
+			IARG_ADDRINT, RTN_Address (rtn),
+			IARG_REG_VALUE, REG_ESP,
+			IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+			IARG_FUNCARG_ENTRYPOINT_VALUE, 1,
+			IARG_FUNCARG_ENTRYPOINT_VALUE, 2, IARG_END);
+	RTN_InsertCall (rtn, IPOINT_AFTER, (AFUNPTR) CopyExit,
+			IARG_THREAD_ID, IARG_FUNCRET_EXITPOINT_VALUE, 
+			IARG_END);
+	RTN_Close (rtn);
+      }
+}
+
+/* ===================================================================== */
+/* Path Coded Control */
+/* ===================================================================== */
+
+// In path mode, the code of the .paths table logs one record per
+// execution of a region rather than one per block, see "Path Coded
+// Control" in traceformat.hxx. The entry of every Diablo block of the
+// table updates the executions open in the frame of its call: those it
+// leaves are logged, the increment of the edge it is reached by is
+// added, and those it enters are opened. Frames are pushed at calls and
+// popped by ESP as in the call index.
+
+//! @brief reads the .paths table and chains its blocks, leaving out
+//         functions with regions nested too deep or numbered too high to
+//         be logged, which then run as excluded code
+//  @return false if the table cannot be read
+static BOOL
+LoadPathChains (const char *path)
+{
+  map<UINT32, PathBlock>::iterator iter;
+  map<ADDRINT, pair<UINT32, vector<PathLevel> > > chains;
+  map<ADDRINT, pair<UINT32, vector<PathLevel> > >::iterator chain;
+  set<UINT32> dropped;
+
+  if (!pathTable.Load (path))
+    return false;
+  for (iter = pathTable.Blocks ().begin (); 
+       iter != pathTable.Blocks ().end (); iter++)
+    {
+      vector<PathLevel> levels;
+      PathLevel level = { iter->second.parent, iter->second.child };
+
+      while (level.region != 0)
+	{
+	  levels.insert (levels.begin (), level);
+	  level.child = pathTable.Region (level.region).child;
+	  level.region = pathTable.Region (level.region).parent;
+	}
+      if (levels.empty ())
+	continue;
+      UINT32 function = levels[0].region;
+      if (levels.size () > TRACE_PATH_DEPTH || 
+	  levels.back ().region >= TRACE_PATH_REGIONS)
+	dropped.insert (function);
+      chains[iter->first] = make_pair (function, levels);
+    }
+
+  for (chain = chains.begin (); chain != chains.end (); chain++)
+    {
+      vector<PathLevel> &levels = chain->second.second;
+      if (dropped.count (chain->second.first))
+	continue;
+
+      PathChain &c = pathChains[chain->first];
+      c.address = chain->first;
+      c.instructions = pathTable.Block (chain->first)->instructions;
+      c.depth = levels.size ();
+      copy (levels.begin (), levels.end (), c.levels);
+      c.entryLevel = c.depth;
+      while (c.entryLevel > 0 && c.levels[c.entryLevel - 1].child == 0)
+	c.entryLevel--;
+    }
+  return true;
+}
+
+//! @brief appends a path record, flushing first if the buffer is full:
+//         leaving many regions at once may log more than INS_SLACK
+static VOID
+RecordPath (THREADID tid, UINT32 ip, UINT32 count)
+{
+  if (threadTraces[tid].control.cursor > threadTraces[tid].control.limit)
+    FlushBuffers (tid, 0, false);
+  RecordBlock (tid, ip, count);
+}
+
+//! @brief logs the executions of the regions of frame f from level from
+//         on, innermost first
+//  @param ended: the executions end before leaving their regions
+//  @param calling: the block being executed ends in a call that has not
+//         returned yet
+static VOID
+LeaveRegions (THREADID tid, PathFrame *f, UINT32 from, BOOL ended,
+	      BOOL calling)
+{
+  for (UINT32 i = f->depth; i-- > from; )
+    {
+      PathExecution *e = &f->levels[i];
+      PathRegion &region = pathTable.Region (e->region);
+      BOOL innermost = f->block && i + 1 == f->block->depth;
+      UINT32 flags = e->flags;
+
+      if (region.exits[e->child] == PATH_NO_EXIT ||
+	  (innermost && (calling || f->executed < f->block->instructions)))
+	ended = true;
+      if (flags & TRACE_PATH_START)
+	RecordPath (tid, region.children[e->start], 0);
+      if (ended)
+	{
+	  flags |= TRACE_PATH_END;
+	  RecordPath (tid, region.children[e->child], 
+		      !innermost ? 0 : 
+		      f->executed | (calling ? TRACE_PATH_CALLING : 0));
+	}
+      else
+	e->sum += region.exits[e->child];
+      RecordPath (tid, e->region, e->sum | flags);
+    }
+  if (from < f->depth)
+    f->depth = from;
+  if (from == 0)
+    f->block = NULL;
+}
+
+//! @brief pops the frames of the calls returned from, whose regions have
+//         been left
+static VOID
+LeaveFrames (THREADID tid, ADDRINT stackPointer)
+{
+  vector<PathFrame> &frames = threadTraces[tid].pathFrames;
+
+  while (frames.size () > 1 && frames.back ().slot < stackPointer)
+    {
+      PathFrame *callee = &frames.back ();
+      LeaveRegions (tid, callee, 0, false, false);
+      if (callee->units != 1)
+	RecordPath (tid, TRACE_PATH_RETURN, callee->units);
+      frames.pop_back ();
+    }
+}
+
+//! @brief moves the frame of the current call into block b
+static VOID
+EnterPathBlock (THREADID tid, ADDRINT stackPointer, const PathChain *b)
+{
+  ThreadTrace *t = &threadTraces[tid];
+
+  LeaveFrames (tid, stackPointer);
+
+  // regions still executed, and the innermost region looping back to b
+  // or entered anew at b, as functions tail calling themselves
+  PathFrame *f = &t->pathFrames.back ();
+  UINT32 common = 0, level, repeat = 0;
+  while (common < f->depth && common < b->depth &&
+	 f->levels[common].region == b->levels[common].region)
+    common++;
+  for (level = common; level > b->entryLevel; level--)
+    if (pathTable.Region (b->levels[level - 1].region).type != 
+	PATH_REGION_ACYCLIC)
+      break;
+
+  if (level > b->entryLevel)
+    {
+      level--;
+      LeaveRegions (tid, f, level, false, false);
+      repeat = TRACE_PATH_REPEAT;
+    }
+  else if (common == 0)
+    LeaveRegions (tid, f, 0, false, false);
+  else
+    {
+      // the edge to b in the innermost region still executed. Without
+      // one, as after a signal, its execution ends and b starts another
+      LeaveRegions (tid, f, common, false, false);
+      level = common - 1;
+      PathExecution *e = &f->levels[level];
+      vector<PathEdge> &edges = pathTable.Region (e->region).successors
+	[e->child];
+      UINT32 i = 0;
+      while (i < edges.size () && edges[i].to != b->levels[level].child)
+	i++;
+      if (i < edges.size ())
+	{
+	  e->sum += edges[i].increment;
+	  e->child = edges[i].to;
+	  level++;
+	}
+      else
+	{
+	  LeaveRegions (tid, f, level, true, false);
+	  repeat = TRACE_PATH_REPEAT;
+	}
+    }
+
+  if (level == 0)
+    f->units++;
+  for (; level < b->depth; level++)
+    {
+      PathExecution *e = &f->levels[level];
+      e->region = b->levels[level].region;
+      e->start = e->child = b->levels[level].child;
+      e->sum = 0;
+      e->flags = (e->start != 0 ? TRACE_PATH_START : 0) | repeat;
+      repeat = 0;
+    }
+  f->depth = b->depth;
+  f->block = b;
+  f->executed = b->instructions;
+  t->pathInstructions += b->instructions;
+}
+
+//! @brief pushes a frame once a call of the table is taken
+static VOID
+EnterPathCall (THREADID tid, ADDRINT stackPointer)
+{
+  PathFrame frame;
+
+  frame.slot = stackPointer;
+  frame.units = frame.depth = 0;
+  frame.block = NULL;
+  frame.executed = 0;
+  threadTraces[tid].pathFrames.push_back (frame);
+}
+
+//! @brief ends the block being executed after its first executed
+//         instructions
+static VOID
+EndPathBlock (THREADID tid, UINT32 executed)
+{
+  ThreadTrace *t = &threadTraces[tid];
+  PathFrame *f = &t->pathFrames.back ();
+
+  if (f->block == NULL || executed >= f->executed)
+    return;
+  t->pathInstructions -= f->executed - executed;
+  f->executed = executed;
+}
+
+//! @brief logs the executions still open at the end of the trace
+static VOID
+ClosePaths (THREADID tid)
+{
+  vector<PathFrame> &frames = threadTraces[tid].pathFrames;
+  BOOL calling = false;
+
+  for (;;)
+    {
+      PathFrame *f = &frames.back ();
+      LeaveRegions (tid, f, 0, true, calling);
+      if (frames.size () == 1)
+	break;
+      if (f->units != 1)
+	RecordPath (tid, TRACE_PATH_RETURN, f->units);
+      frames.pop_back ();
+      calling = true;
+    }
+}
+
+/* ===================================================================== */
+/* Region of Interest */
+/* ===================================================================== */
+
+// Until the start of the region, code is instrumented to count its
+// instructions & check for the start only. The start, and the end, remove
+// all instrumentation so that code is instrumented anew.
+
+//! @brief counts the instructions of a block before the region
+//  @return true once the thread has executed startAfter instructions
+static ADDRINT
+CountSkipped (THREADID tid, UINT32 count)
+{
+  ThreadTrace *t = &threadTraces[tid];
+  t->instructions += count;
+  return t->instructions >= startAfter;
+}
+
+static ADDRINT
+CountStart ()
+{
+  return __sync_add_and_fetch (&startHits, 1) == KnobStartCount.Value ();
+}
+
+//! @brief starts the region and executes the current instruction again,
+//         under the new instrumentation
+//  @param uncount instructions counted ahead by CountSkipped that are
+//         still to be executed
+static VOID
+StartRegion (THREADID tid, UINT32 uncount, CONTEXT *ctxt)
+{
+  threadTraces[tid].instructions -= uncount;
+
+  GetLock (&traceLock, tid + 1);
+  if (roiState == ROI_WAITING)
+    {
+      roiState = ROI_RECORDING;
+      PIN_RemoveInstrumentation ();
+    }
+  ReleaseLock (&traceLock);
+  PIN_ExecuteAt (ctxt);
+}
+
+//! @brief ends the region: the trace of the current thread ends here,
+//         those of the others at their next instruction boundary
+static VOID
+EndRegion (THREADID tid, ADDRINT framePointer)
+{
+  EndTrace (tid, framePointer);
+  for (THREADID other = 0; other < MAX_THREADS; other++)
+    if (other != tid && threadTraces[other].data.base)
+      {
+	threadTraces[other].endRequested = true;
+	threadTraces[other].pending = true;
+      }
+
+  GetLock (&traceLock, tid + 1);
+  roiState = ROI_ENDED;
+  PIN_RemoveInstrumentation ();
+  ReleaseLock (&traceLock);
+
+  if (KnobStopAction.Value () == "detach")
+    PIN_Detach ();
+}
+
+//! @brief ends the region before the stop_count-th execution of stop_ip
+static VOID
+StopRegion (THREADID tid, ADDRINT ip, ADDRINT framePointer)
 {
-  traceDataFile.write ((char *) &addr, sizeof (addr));
-  traceDataFile.write ((char *) &size, sizeof (size));
-//  cerr << "(" << r << " " << addr << "," << size << " ) ";
+  if (__sync_add_and_fetch (&stopHits, 1) != KnobStopCount.Value ())
+    return;
 
+  if (blockControl)
+    TruncateBlock (tid, ip, 0);
+  EndRegion (tid, framePointer);
 }
 
-static VOID *WriteAddr;
-static INT32 WriteSize;
+//! @brief counts the instructions of a block in the region
+//  @return true if the block would take the thread past -stop_after
+static ADDRINT
+CountStop (THREADID tid, UINT32 count)
+{
+  ThreadTrace *t = &threadTraces[tid];
+  t->regionInstructions += count;
+  return t->regionInstructions > KnobStopAfter.Value () &&
+    roiState == ROI_RECORDING;
+}
 
-static VOID 
-RecordWriteAddrSize (VOID * addr, INT32 size)
+//! @brief CountStop at the first iteration of a block head repeated by a
+//         prefix
+static ADDRINT
+CountStopOnce (BOOL first, THREADID tid, UINT32 count)
 {
-  WriteAddr = addr;
-  WriteSize = size;
+  return first && CountStop (tid, count);
 }
 
-static VOID 
-RecordMemWrite (VOID *ip)
+
+//! @brief mirrors the classification of I386_AddOperandVars: EBP-relative
+//         operands are StackVars, resolved by the slicer without help of
+//         the trace with -elide, and absolute ones MemVars, resolved
+//         always. Implicit operands, such as the [EBP] read by leave, are
+//         DynVars of I386_AddImplicitVarUses whatever their base.
+static BOOL
+IsStaticOperand (INS ins, UINT32 op, UINT32 size)
+{
+  REG base = INS_OperandMemoryBaseReg (ins, op);
+  REG segment = INS_SegmentPrefix (ins) ? 
+    INS_SegmentRegPrefix (ins) : REG_INVALID ();
+
+  if (INS_OperandIsImplicit (ins, op) ||
+      REG_valid (INS_OperandMemoryIndexReg (ins, op)) || size >= 16)
+    return false;
+  if (base == REG_EBP)
+    return KnobElide && (!REG_valid (segment) || segment == REG_SEG_SS);
+  if (!REG_valid (base))
+    return !REG_valid (segment) || segment == REG_SEG_DS;
+  return false;
+}
+
+static BOOL
+WritesFramePointer (INS ins)
+{
+  for (UINT32 i = 0; i < INS_MaxNumWRegs (ins); i++)
+    if (REG_FullRegName (INS_RegW (ins, i)) == REG_EBP)
+      return true;
+  return false;
+}
+
+/* ===================================================================== */
+/* Code Selection */
+/* ===================================================================== */
+
+//! @brief adds a knob value to a filter: an address range <lo>-<hi>, or
+//         the name of a function or image, resolved as images are loaded
+//  @return false if the value is malformed
+static BOOL
+ParseFilter (const string &value, CodeFilter *filter)
+{
+  if (value.empty ())
+    return true;
+
+  size_t dash = value.find ('-');
+  if (isdigit (value[0]) && dash != string::npos)
+    {
+      char *end;
+      ADDRINT low = strtoul (value.c_str (), &end, 0);
+      if (end != value.c_str () + dash)
+	return false;
+      ADDRINT high = strtoul (value.c_str () + dash + 1, &end, 0);
+      if (*end != 0 || high <= low)
+	return false;
+      filter->ranges.push_back (make_pair (low, high));
+    }
+  else
+    filter->names.push_back (value);
+  return true;
+}
+
+//! @brief adds the ranges of the functions & images of img that are named
+//         by filter
+static VOID
+ResolveFilter (IMG img, CodeFilter *filter)
+{
+  string path = IMG_Name (img);
+  string file = path.substr (path.rfind ('/') + 1);
+
+  for (UINT32 i = 0; i < filter->names.size (); i++)
+    {
+      const string &name = filter->names[i];
+
+      if (file.compare (0, name.size (), name) == 0)
+	filter->ranges.push_back (make_pair (IMG_LowAddress (img), 
+					     IMG_HighAddress (img) + 1));
+
+      for (SEC sec = IMG_SecHead (img); SEC_Valid (sec); sec = SEC_Next (sec))
+	for (RTN rtn = SEC_RtnHead (sec); RTN_Valid (rtn); rtn = RTN_Next (rtn))
+	  if (RTN_Name (rtn) == name)
+	    filter->ranges.push_back (make_pair (RTN_Address (rtn), 
+						 RTN_Address (rtn) + 
+						 RTN_Size (rtn)));
+    }
+}
+
+static BOOL
+FilterMatches (CodeFilter *filter, ADDRINT addr)
+{
+  for (UINT32 i = 0; i < filter->ranges.size (); i++)
+    if (filter->ranges[i].first <= addr && addr < filter->ranges[i].second)
+      return true;
+  return false;
+}
+
+//! @return false for code selected by -exclude, or not by -include, and
+//          in path mode for code not in the table
+static BOOL
+IsTracedCode (ADDRINT addr)
+{
+  if (pathControl)
+    {
+      const PathBlock *block = pathTable.Find (addr);
+      if (block == NULL || pathChains.count (block->address) == 0)
+	return false;
+    }
+  if ((!includeFilter.names.empty () || !includeFilter.ranges.empty ()) &&
+      !FilterMatches (&includeFilter, addr))
+    return false;
+  return !FilterMatches (&excludeFilter, addr) && 
+    !FilterMatches (&copyFilter, addr);
+}
+
+//! @brief marks the pages of img that only hold sections which are not
+//         writeable, leaving out pages shared with writeable sections,
+//         e.g. by .got, which the loader relocates
+static VOID
+MarkImmutable (IMG img)
+{
+  for (UINT32 writeable = 0; writeable < 2; writeable++)
+    for (SEC sec = IMG_SecHead (img); SEC_Valid (sec); sec = SEC_Next (sec))
+      {
+	if (!SEC_Mapped (sec) || SEC_Size (sec) == 0 ||
+	    (UINT32) SEC_IsWriteable (sec) != writeable)
+	  continue;
+
+	UINT32 first = SEC_Address (sec) >> IMMUTABLE_PAGE_SHIFT;
+	UINT32 last = (SEC_Address (sec) + SEC_Size (sec) - 1) 
+	  >> IMMUTABLE_PAGE_SHIFT;
+	for (UINT32 page = first; page <= last; page++)
+	  if (writeable)
+	    immutablePages[page >> 5] &= ~(1u << (page & 31));
+	  else
+	    immutablePages[page >> 5] |= 1u << (page & 31);
+      }
+}
+
+VOID ImageLoad (IMG img, VOID *v)
+{
+  GetLock (&traceLock, PIN_ThreadId () + 1);
+  ResolveFilter (img, &includeFilter);
+  ResolveFilter (img, &excludeFilter);
+  if (KnobImmutable)
+    MarkImmutable (img);
+  ReleaseLock (&traceLock);
+
+  if (KnobLifetimes)
+    InstrumentAllocator (img);
+  if (KnobRanges)
+    InstrumentCopies (img);
+}
+
+/* ===================================================================== */
+/* Instrumentation */
+/* ===================================================================== */
+
+//! @brief instruments excluded code, which logs nothing but the summary
+//         of the memory it accesses, see RecordOpaque. Registers are not
+//         summarized: the slicer assumes excluded code keeps to the
+//         calling convention.
+static VOID
+InstrumentOpaque (INS ins, BOOL entry)
+{
+  if (entry)
+    INS_InsertCall (ins, IPOINT_BEFORE, (AFUNPTR) OpaqueEnter,
+		    IARG_THREAD_ID,
+		    IARG_INST_PTR,
+		    IARG_REG_VALUE, REG_EBP,
+		    IARG_REG_VALUE, REG_ESP,
+		    IARG_END);
+
+  if (INS_IsMemoryRead (ins))
+    INS_InsertPredicatedCall (ins, IPOINT_BEFORE, (AFUNPTR) OpaqueRead,
+			      IARG_THREAD_ID,
+			      IARG_MEMORYREAD_EA,
+			      IARG_MEMORYREAD_SIZE,
+			      IARG_END);
+  if (INS_HasMemoryRead2 (ins))
+    INS_InsertPredicatedCall (ins, IPOINT_BEFORE, (AFUNPTR) OpaqueRead,
+			      IARG_THREAD_ID,
+			      IARG_MEMORYREAD2_EA,
+			      IARG_MEMORYREAD_SIZE,
+			      IARG_END);
+  if (INS_IsMemoryWrite (ins))
+    INS_InsertPredicatedCall (ins, IPOINT_BEFORE, (AFUNPTR) OpaqueWrite,
+			      IARG_THREAD_ID,
+			      IARG_MEMORYWRITE_EA,
+			      IARG_MEMORYWRITE_SIZE,
+			      IARG_END);
+}
+
+/* ===================================================================== */
+
+// Pin runs a rep movs or stos as one execution of the instruction per
+// element. Such an instruction logs its records at the first iteration
+// only, as when it moved all its elements at once: a single control
+// record, and the ranges it reads & writes as data records, in the order
+// & slots of its element accesses. In block mode, where the control trace
+// holds an instruction once however often a prefix repeats it, every
+// repeated string instruction logs its data records once: rep movs & stos
+// as ranges, others as records widened by every iteration.
+
+//! @return true for string instructions repeated by a prefix
+static BOOL
+IsRepeated (INS ins)
+{
+  return INS_RepPrefix (ins) || INS_RepnePrefix (ins);
+}
+
+//! @return true for rep movs & rep stos, whose count is known up front
+static BOOL
+IsRepString (INS ins)
+{
+  switch (INS_Opcode (ins))
+    {
+    case XED_ICLASS_MOVSB:
+    case XED_ICLASS_MOVSW:
+    case XED_ICLASS_MOVSD:
+    case XED_ICLASS_STOSB:
+    case XED_ICLASS_STOSW:
+    case XED_ICLASS_STOSD:
+      return INS_RepPrefix (ins);
+    }
+  return false;
+}
+
+static ADDRINT
+IsFirstIteration (BOOL first)
+{
+  return first;
+}
+
+//! @brief logs the range of count elements of size bytes from addr on,
+//         downwards with the direction flag set. A load from immutable
+//         memory has size 0, as in RecordLoad.
+static VOID
+RecordRange (THREADID tid, ADDRINT addr, ADDRINT count, ADDRINT flags,
+	     UINT32 size, UINT32 slot, BOOL load)
 {
-  RecordMem(ip, 'W', WriteAddr, WriteSize, false);  
+  if (flags & 0x400)
+    addr -= count ? (count - 1) * size : 0;
+  size *= count;
+  if (load && size && IsImmutable (addr, size))
+    size = 0;
+  RecordMem (tid, addr, size, slot);
 }
 
-int insCount;
+//! @brief logs an access of an iteration of a repeated string instruction:
+//         the first logs the record of its k-th operand, later ones widen
+//         it to the elements accessed so far. A flush in between, as in a
+//         signal handler run mid-instruction, ends the widening. With no
+//         iteration, as when ECX is 0, the record has size 0, as has a
+//         load of immutable memory only, see RecordLoad.
+static VOID
+RecordRepeated (THREADID tid, BOOL first, BOOL executing, ADDRINT addr,
+		UINT32 size, UINT32 slot, UINT32 k, BOOL load)
+{
+  ThreadTrace *t = &threadTraces[tid];
+
+  if (first)
+    {
+      t->repeated[k] = t->data.cursor - t->data.base;
+      t->repeatedFlushed = t->dataRecords;
+      t->repeatedSize[k] = executing ? size : 0;
+      if (load && executing && IsImmutable (addr, size))
+	size = 0;
+      RecordMem (tid, addr, executing ? size : 0, slot);
+      return;
+    }
+  if (!executing || t->dataRecords != t->repeatedFlushed)
+    return;
+
+  // the record keeps size 0 while all elements so far are immutable
+  DataRecord *r = (DataRecord *) (t->data.base + t->repeated[k]);
+  if (addr < r->addr)
+    r->addr = addr;
+  t->repeatedSize[k] += size;
+  if (r->size != 0 || !load || !IsImmutable (addr, size))
+    r->size = t->repeatedSize[k];
+}
 
+//! @brief instruments a repeated string instruction other than rep movs &
+//         stos in block mode, whose count depends on the data it compares
 static VOID
-RecordControlPred (VOID *ip)
+InstrumentRepeated (INS ins)
 {
-  insCount++;	
-  traceControlFile.write ((char *) &ip, sizeof (ip));
-  // cerr << ip << endl;
+  UINT32 k = 0;
+
+  if (INS_IsMemoryRead (ins))
+    {
+      INS_InsertCall (ins, IPOINT_BEFORE, (AFUNPTR) RecordRepeated,
+		      IARG_THREAD_ID,
+		      IARG_FIRST_REP_ITERATION,
+		      IARG_EXECUTING,
+		      IARG_MEMORYREAD_EA,
+		      IARG_MEMORYREAD_SIZE,
+		      IARG_UINT32, TraceSlot (INS_Address (ins), k),
+		      IARG_UINT32, k,
+		      IARG_BOOL, (BOOL) KnobImmutable,
+		      IARG_END);
+      k++;
+    }
+  if (INS_HasMemoryRead2 (ins))
+    {
+      INS_InsertCall (ins, IPOINT_BEFORE, (AFUNPTR) RecordRepeated,
+		      IARG_THREAD_ID,
+		      IARG_FIRST_REP_ITERATION,
+		      IARG_EXECUTING,
+		      IARG_MEMORYREAD2_EA,
+		      IARG_MEMORYREAD_SIZE,
+		      IARG_UINT32, TraceSlot (INS_Address (ins), k),
+		      IARG_UINT32, k,
+		      IARG_BOOL, (BOOL) KnobImmutable,
+		      IARG_END);
+      k++;
+    }
+  if (INS_IsMemoryWrite (ins))
+    INS_InsertCall (ins, IPOINT_BEFORE, (AFUNPTR) RecordRepeated,
+		    IARG_THREAD_ID,
+		    IARG_FIRST_REP_ITERATION,
+		    IARG_EXECUTING,
+		    IARG_MEMORYWRITE_EA,
+		    IARG_MEMORYWRITE_SIZE,
+		    IARG_UINT32, TraceSlot (INS_Address (ins), k),
+		    IARG_UINT32, k,
+		    IARG_BOOL, false,
+		    IARG_END);
 }
 
+static VOID
+InstrumentRepString (INS ins)
+{
+  UINT32 k = 0;
+
+  if (INS_IsMemoryRead (ins))
+    {
+      INS_InsertIfCall (ins, IPOINT_BEFORE, (AFUNPTR) IsFirstIteration,
+			IARG_FIRST_REP_ITERATION,
+			IARG_END);
+      INS_InsertThenCall (ins, IPOINT_BEFORE, (AFUNPTR) RecordRange,
+			  IARG_THREAD_ID,
+			  IARG_REG_VALUE, REG_ESI,
+			  IARG_REG_VALUE, REG_ECX,
+			  IARG_REG_VALUE, REG_EFLAGS,
+			  IARG_UINT32, INS_MemoryReadSize (ins),
+			  IARG_UINT32, TraceSlot (INS_Address (ins), k++),
+			  IARG_BOOL, (BOOL) KnobImmutable,
+			  IARG_END);
+    }
+  INS_InsertIfCall (ins, IPOINT_BEFORE, (AFUNPTR) IsFirstIteration,
+		    IARG_FIRST_REP_ITERATION,
+		    IARG_END);
+  INS_InsertThenCall (ins, IPOINT_BEFORE, (AFUNPTR) RecordRange,
+		      IARG_THREAD_ID,
+		      IARG_REG_VALUE, REG_EDI,
+		      IARG_REG_VALUE, REG_ECX,
+		      IARG_REG_VALUE, REG_EFLAGS,
+		      IARG_UINT32, INS_MemoryWriteSize (ins),
+		      IARG_UINT32, TraceSlot (INS_Address (ins), k++),
+		      IARG_BOOL, false,
+		      IARG_END);
+
+  if (blockControl)
+    return;
+  INS_InsertIfCall (ins, IPOINT_BEFORE, (AFUNPTR) IsFirstIteration,
+		    IARG_FIRST_REP_ITERATION,
+		    IARG_END);
+  INS_InsertThenCall (ins, IPOINT_BEFORE, (AFUNPTR) RecordControlPred,
+		      IARG_THREAD_ID,
+		      IARG_INST_PTR,
+		      IARG_END);
+}
 
 VOID Instruction(INS ins, VOID *v)
 {    
+  // make room for all records of this instruction before writing any,
+  // blocks are checked as a whole by Trace
+  if (!blockControl)
+    {
+      INS_InsertIfCall (ins, IPOINT_BEFORE, (AFUNPTR) BuffersFull,
+			IARG_THREAD_ID,
+			IARG_UINT32, INS_SLACK,
+			IARG_END);
+      INS_InsertThenCall (ins, IPOINT_BEFORE, (AFUNPTR) FlushBuffersAt,
+			  IARG_THREAD_ID,
+			  IARG_REG_VALUE, REG_EBP,
+			  IARG_UINT32, INS_SLACK,
+			  IARG_CONTEXT,
+			  IARG_END);
+    }
+
+  if (KnobRing && INS_Address (ins) == KnobTriggerIp.Value ())
+    INS_InsertCall (ins, IPOINT_BEFORE, (AFUNPTR) CountTrigger, IARG_END);
+
+  // after the flush check, so that the trace ends on a boundary
+  if (KnobStopIp && INS_Address (ins) == KnobStopIp.Value ())
+    INS_InsertCall (ins, IPOINT_BEFORE, (AFUNPTR) StopRegion,
+		    IARG_THREAD_ID,
+		    IARG_INST_PTR,
+		    IARG_REG_VALUE, REG_EBP,
+		    IARG_END);
+
+  if ((KnobRanges || blockControl) && IsRepString (ins))
+    {
+      InstrumentRepString (ins);
+      return;
+    }
+  if (blockControl && IsRepeated (ins))
+    {
+      InstrumentRepeated (ins);
+      return;
+    }
+
+  // the k-th access logged by an instruction is delta encoded against
+  // the previous k-th access of the same instruction
+  UINT32 k = 0;
+
+  // memory operands in the order of IARG_MEMORYREAD_EA, 
+  // IARG_MEMORYREAD2_EA and IARG_MEMORYWRITE_EA
+  BOOL readStatic[2] = { false, false };
+  BOOL writeStatic = false;
+  UINT32 reads = 0, writes = 0;
+
+  for (UINT32 op = 0; op < INS_OperandCount (ins); op++)
+    {
+      if (!INS_OperandIsMemory (ins, op))
+	continue;
+      if (INS_OperandRead (ins, op) && reads < 2)
+	readStatic[reads++] = 
+	  IsStaticOperand (ins, op, INS_MemoryReadSize (ins));
+      if (INS_OperandWritten (ins, op) && writes++ == 0)
+	writeStatic = IsStaticOperand (ins, op, INS_MemoryWriteSize (ins));
+    }
+
   // instruments loads using a predicated call, i.e.
   // the call happens iff the load will be actually executed
+  AFUNPTR load = KnobImmutable ? (AFUNPTR) RecordLoad : (AFUNPTR) RecordMem;
             
-  if (INS_IsMemoryRead (ins))
+  if (INS_IsMemoryRead (ins) && !readStatic[0])
     {
-      INS_InsertPredicatedCall (ins, IPOINT_BEFORE, (AFUNPTR) RecordMem,
-				IARG_INST_PTR,
-				IARG_UINT32, 'R',
+      INS_InsertPredicatedCall (ins, IPOINT_BEFORE, load,
+				IARG_THREAD_ID,
 				IARG_MEMORYREAD_EA,
 				IARG_MEMORYREAD_SIZE,
-				IARG_UINT32, INS_IsPrefetch (ins),
+				IARG_UINT32, TraceSlot (INS_Address (ins), k++),
 				IARG_END);
     }
 
-    if (INS_HasMemoryRead2 (ins))
+    if (INS_HasMemoryRead2 (ins) && !readStatic[1])
       {
-        INS_InsertPredicatedCall (ins, IPOINT_BEFORE, (AFUNPTR)RecordMem,
-				  IARG_INST_PTR,
-				  IARG_UINT32, 'R',
+        INS_InsertPredicatedCall (ins, IPOINT_BEFORE, load,
+				  IARG_THREAD_ID,
 				  IARG_MEMORYREAD2_EA,
 				  IARG_MEMORYREAD_SIZE,
-				  IARG_UINT32, INS_IsPrefetch(ins),
+				  IARG_UINT32, TraceSlot (INS_Address (ins), k++),
 				  IARG_END);
       }
 
     // instruments stores using a predicated call, i.e.
-    // the call happens iff the store will be actually executed
-    if (INS_IsMemoryWrite (ins))
+    // the call happens iff the store will be actually executed.
+    // The effective address is already known before the store, and
+    // recording it there keeps it after the reads of the same instruction.
+    if (INS_IsMemoryWrite (ins) && !writeStatic)
       {
-        INS_InsertPredicatedCall (ins, IPOINT_BEFORE, 
-				  (AFUNPTR) RecordWriteAddrSize,
+        INS_InsertPredicatedCall (ins, IPOINT_BEFORE, (AFUNPTR) RecordMem,
+				  IARG_THREAD_ID,
 				  IARG_MEMORYWRITE_EA,
 				  IARG_MEMORYWRITE_SIZE,
+				  IARG_UINT32, TraceSlot (INS_Address (ins), k++),
+				  IARG_END);
+      }
+
+    // the slicer walks the trace backwards, recovering the frame pointer
+    // of StackVars from the value each write of EBP overwrites
+    if (KnobElide && WritesFramePointer (ins))
+      {
+        INS_InsertPredicatedCall (ins, IPOINT_BEFORE, (AFUNPTR) RecordMem,
+				  IARG_THREAD_ID,
+				  IARG_REG_VALUE, REG_EBP,
+				  IARG_UINT32, 4,
+				  IARG_UINT32, TraceSlot (INS_Address (ins), k++),
+				  IARG_END);
+      }
+
+    // and the stack below ESP at a call, as the frame of the callee is
+    // not live before it
+    if (INS_IsCall (ins))
+      {
+        INS_InsertPredicatedCall (ins, IPOINT_BEFORE, (AFUNPTR) RecordMem,
+				  IARG_THREAD_ID,
+				  IARG_REG_VALUE, REG_ESP,
+				  IARG_UINT32, 4,
+				  IARG_UINT32, TraceSlot (INS_Address (ins), k++),
 				  IARG_END);
-        
-        if (INS_HasFallThrough (ins))
-	  {
-            INS_InsertCall (ins, IPOINT_AFTER, 
-			    (AFUNPTR) RecordMemWrite,
-			    IARG_INST_PTR,
-			    IARG_END);	    
-	  }
-        if (INS_IsBranchOrCall (ins))
-	  {
-            INS_InsertCall (ins, IPOINT_TAKEN_BRANCH, 
-			    (AFUNPTR) RecordMemWrite,
-			    IARG_INST_PTR,
-			    IARG_END);
-	  }        
       }
 
+    if (blockControl)
+      return;
+
     // instrument each instruction to save predecessor's instruction pointer.
     if (INS_HasFallThrough (ins))
       {
 	INS_InsertCall (ins, IPOINT_AFTER,
 			(AFUNPTR) RecordControlPred,
+			IARG_THREAD_ID,
 			IARG_INST_PTR,
 			IARG_END);
       }
@@ -174,19 +2619,459 @@ VOID Instruction(INS ins, VOID *v)
       {
 	INS_InsertCall (ins, IPOINT_TAKEN_BRANCH,
 			(AFUNPTR) RecordControlPred,
+			IARG_THREAD_ID,
 			IARG_INST_PTR,
 			IARG_END);
       }
     return;
 }
 
+//! @brief instruments code run before the region of interest to count
+//         its instructions and check for the start of the region
+static VOID
+InstrumentWaiting (TRACE trace)
+{
+  for (BBL bbl = TRACE_BblHead (trace); BBL_Valid (bbl); bbl = BBL_Next (bbl))
+    {
+      UINT32 count = BBL_NumIns (bbl);
+
+      BBL_InsertIfCall (bbl, IPOINT_BEFORE, (AFUNPTR) CountSkipped,
+			IARG_THREAD_ID,
+			IARG_UINT32, count,
+			IARG_END);
+      BBL_InsertThenCall (bbl, IPOINT_BEFORE, (AFUNPTR) StartRegion,
+			  IARG_THREAD_ID,
+			  IARG_UINT32, count,
+			  IARG_CONTEXT,
+			  IARG_END);
+      if (KnobStartIp == 0)
+	continue;
+
+      UINT32 i = 0;
+      for (INS ins = BBL_InsHead (bbl); INS_Valid (ins); ins = INS_Next (ins))
+	{
+	  if (INS_Address (ins) == KnobStartIp.Value ())
+	    {
+	      INS_InsertIfCall (ins, IPOINT_BEFORE, (AFUNPTR) CountStart,
+				IARG_END);
+	      INS_InsertThenCall (ins, IPOINT_BEFORE, (AFUNPTR) StartRegion,
+				  IARG_THREAD_ID,
+				  IARG_UINT32, count - i,
+				  IARG_CONTEXT,
+				  IARG_END);
+	    }
+	  i++;
+	}
+    }
+}
+
+//! @brief keeps the instruction addresses of the block at start, unless
+//         a longer layout of it is known
+static VOID
+KeepLayout (ADDRINT start, vector<ADDRINT> &layout)
+{
+  GetLock (&traceLock, PIN_ThreadId () + 1);
+  if (layout.size () > blockLayouts[start].size ())
+    blockLayouts[start].swap (layout);
+  ReleaseLock (&traceLock);
+  layout.clear ();
+}
+
+// INS_InsertCall, or INS_InsertThenCall after an If call
+typedef VOID (*InsertCall) (INS, IPOINT, AFUNPTR, ...);
+
+//! @brief calls at an instruction repeated by a prefix run at every
+//         iteration; for those of a block, which is entered once, an If
+//         call takes the first only
+//  @return how to insert a call at ins that runs once per block entry
+static InsertCall
+OnceAt (INS ins)
+{
+  if (!IsRepeated (ins))
+    return INS_InsertCall;
+  INS_InsertIfCall (ins, IPOINT_BEFORE, (AFUNPTR) IsFirstIteration,
+		    IARG_FIRST_REP_ITERATION,
+		    IARG_END);
+  return INS_InsertThenCall;
+}
+
+//! @brief instruments all instructions of a trace. In block mode, each of
+//         its blocks is logged once, at the block's entry. Pin blocks end
+//         at control transfers only, so the slicer expands a (start, count)
+//         record by walking instructions in address order.
+VOID Trace (TRACE trace, VOID *v)
+{
+  if (roiState == ROI_WAITING)
+    {
+      InstrumentWaiting (trace);
+      return;
+    }
+  if (roiState == ROI_ENDED)
+    return;
+
+  for (BBL bbl = TRACE_BblHead (trace); BBL_Valid (bbl); bbl = BBL_Next (bbl))
+    {
+      INS head = BBL_InsHead (bbl);
+      BOOL repeated = IsRepeated (head);
+
+      // the region ends before the block that would overrun it, ahead of
+      // all records of the block
+      if (KnobStopAfter)
+	{
+	  if (repeated)
+	    BBL_InsertIfCall (bbl, IPOINT_BEFORE, (AFUNPTR) CountStopOnce,
+			      IARG_FIRST_REP_ITERATION,
+			      IARG_THREAD_ID,
+			      IARG_UINT32, BBL_NumIns (bbl),
+			      IARG_END);
+	  else
+	    BBL_InsertIfCall (bbl, IPOINT_BEFORE, (AFUNPTR) CountStop,
+			      IARG_THREAD_ID,
+			      IARG_UINT32, BBL_NumIns (bbl),
+			      IARG_END);
+	  BBL_InsertThenCall (bbl, IPOINT_BEFORE, (AFUNPTR) EndRegion,
+			      IARG_THREAD_ID,
+			      IARG_REG_VALUE, REG_EBP,
+			      IARG_END);
+	}
+
+      if (!blockControl)
+	{
+	  BOOL traced = true;
+	  for (INS ins = head; INS_Valid (ins); ins = INS_Next (ins))
+	    {
+	      BOOL entry = ins == head || traced;
+	      traced = IsTracedCode (INS_Address (ins));
+	      if (traced)
+		Instruction (ins, v);
+	      else
+		InstrumentOpaque (ins, entry);
+	    }
+	  continue;
+	}
+
+      // blocks are selected as a whole, by their first instruction
+      if (!IsTracedCode (BBL_Address (bbl)))
+	{
+	  for (INS ins = head; INS_Valid (ins); ins = INS_Next (ins))
+	    InstrumentOpaque (ins, ins == head);
+	  continue;
+	}
+
+      // in path mode, blocks of the table are entered ahead of the flush
+      // check, so that pending events follow the executions they leave
+      map<ADDRINT, PathChain>::iterator chain = 
+	pathChains.find (BBL_Address (bbl));
+      if (pathControl && chain != pathChains.end ())
+	OnceAt (head) (head, IPOINT_BEFORE, (AFUNPTR) EnterPathBlock,
+		       IARG_THREAD_ID,
+		       IARG_REG_VALUE, REG_ESP,
+		       IARG_PTR, &chain->second,
+		       IARG_END);
+
+      // flushing only between blocks keeps both streams in step at every
+      // index entry; an instruction logs at most 4 data records, repeated
+      // string instructions included
+      UINT32 dataBytes = BBL_NumIns (bbl) * 4 * sizeof (DataRecord);
+      ASSERTX (dataBytes <= KnobBufferSize.Value () - BUFFER_SLACK);
+      if (repeated)
+	INS_InsertIfCall (head, IPOINT_BEFORE, (AFUNPTR) BuffersFullOnce,
+			  IARG_FIRST_REP_ITERATION,
+			  IARG_THREAD_ID,
+			  IARG_UINT32, dataBytes,
+			  IARG_END);
+      else
+	INS_InsertIfCall (head, IPOINT_BEFORE, (AFUNPTR) BuffersFull,
+			  IARG_THREAD_ID,
+			  IARG_UINT32, dataBytes,
+			  IARG_END);
+      INS_InsertThenCall (head, IPOINT_BEFORE, (AFUNPTR) FlushBuffersAt,
+			  IARG_THREAD_ID,
+			  IARG_REG_VALUE, REG_EBP,
+			  IARG_UINT32, dataBytes,
+			  IARG_CONTEXT,
+			  IARG_END);
+      if (!pathControl)
+	OnceAt (head) (head, IPOINT_BEFORE, (AFUNPTR) RecordBlock,
+		       IARG_THREAD_ID,
+		       IARG_UINT32, (UINT32) BBL_Address (bbl),
+		       IARG_UINT32, (UINT32) BBL_NumIns (bbl),
+		       IARG_END);
+
+      // a block of Pin may span several Diablo blocks, each entered and
+      // laid out on its own in path mode
+      vector<ADDRINT> layout;
+      ADDRINT start = BBL_Address (bbl);
+      for (INS ins = head; INS_Valid (ins); ins = INS_Next (ins))
+	{
+	  chain = pathChains.find (INS_Address (ins));
+	  if (pathControl && ins != head && chain != pathChains.end ())
+	    {
+	      KeepLayout (start, layout);
+	      start = INS_Address (ins);
+	      OnceAt (ins) (ins, IPOINT_BEFORE, (AFUNPTR) EnterPathBlock,
+			    IARG_THREAD_ID,
+			    IARG_REG_VALUE, REG_ESP,
+			    IARG_PTR, &chain->second,
+			    IARG_END);
+	    }
+
+	  Instruction (ins, v);
+	  if (pathControl && INS_IsCall (ins))
+	    INS_InsertCall (ins, IPOINT_TAKEN_BRANCH, (AFUNPTR) EnterPathCall,
+			    IARG_THREAD_ID,
+			    IARG_REG_VALUE, REG_ESP,
+			    IARG_END);
+	  layout.push_back (INS_Address (ins));
+	}
+      KeepLayout (start, layout);
+    }
+}
+
 /* ===================================================================== */
 
+// Threads synchronize through the kernel, so an epoch marker at every
+// system call orders the events of different threads up to the code
+// between two consecutive calls.
+VOID SyscallEntry (THREADID tid, CONTEXT *ctxt, SYSCALL_STANDARD std, VOID *v)
+{
+  ThreadTrace *t = &threadTraces[tid];
+
+  RecordEpoch (tid);
+  t->syscallFramePointer = PIN_GetContextReg (ctxt, REG_EBP);
+  t->syscallControlRecords = t->controlRecords + 
+    (t->control.cursor - t->control.base) / controlRecordSize;
+}
+
+//! @brief opens the trace files of a thread and writes their headers
+static VOID
+OpenTraceFiles (THREADID tid)
+{
+  ThreadTrace *t = &threadTraces[tid];
+
+  GetLock (&traceLock, tid + 1);
+  if (KnobSegment)
+    mkdir (SegmentDirectory (t->segment).c_str (), 0777);
+  t->dataFile = OpenSink (KnobSink.Value (), 
+			  SegmentFileName ("data", tid, t->segment).c_str ());
+  t->controlFile = 
+    OpenSink (KnobSink.Value (), 
+	      SegmentFileName ("control", tid, t->segment).c_str ());
+  t->indexFile = 
+    new ofstream (SegmentFileName ("index", tid, t->segment).c_str ());
+  ReleaseLock (&traceLock);
+
+  TraceHeader controlHeader;
+  InitHeader (&controlHeader, TRACE_STREAM_CONTROL, 
+	      (blockControl ? TRACE_CONTROL_BLOCKS : TRACE_CONTROL_RAW) |
+	      (KnobRepeats ? TRACE_CONTROL_REPEATS : 0) |
+	      (pathControl ? TRACE_CONTROL_PATHS : 0), tid);
+  ASSERTX (t->dataFile && t->controlFile);
+  t->controlFile->Write (&controlHeader, sizeof (controlHeader));
+  t->dataFile->Write (&t->dataHeader, sizeof (t->dataHeader));
+  t->controlBytes = sizeof (controlHeader);
+  t->dataBytes = sizeof (t->dataHeader);
+
+  TraceHeader indexHeader;
+  InitHeader (&indexHeader, TRACE_STREAM_INDEX, 0, tid);
+  t->indexFile->write ((char *) &indexHeader, sizeof (indexHeader));
+}
+
+static VOID
+CloseTraceFiles (THREADID tid)
+{
+  ThreadTrace *t = &threadTraces[tid];
+
+  GetLock (&traceLock, tid + 1);
+  t->dataFile->Close ();
+  t->controlFile->Close ();
+  delete t->dataFile;
+  delete t->controlFile;
+  delete t->indexFile;
+  t->dataFile = t->controlFile = NULL;
+  t->indexFile = NULL;
+  ReleaseLock (&traceLock);
+}
+
+VOID ThreadStart (THREADID tid, CONTEXT *ctxt, INT32 flags, VOID *v)
+{
+  ThreadTrace *t = &threadTraces[tid];
+
+  ASSERTX (tid < MAX_THREADS);
+  AllocateBuffer (&t->data);
+  AllocateBuffer (&t->control);
+  t->instructions = t->controlRecords = t->dataRecords = 0;
+  t->indexedInstructions = t->markers = 0;
+
+  // a chunk never outgrows its records plus one anchor per slot
+  t->chunk = new UINT8[KnobBufferSize.Value () + 
+		       TRACE_SLOTS * 3 * 10 + TRACE_CHUNK_TRAILER];
+  memset (t->lastAddr, 0, sizeof (t->lastAddr));
+  memset (t->lastSize, 0, sizeof (t->lastSize));
+  memset (t->slotUsed, 0, sizeof (t->slotUsed));
+
+  // every token stands for at least one record of 4 bytes or more, and
+  // takes at most two 5-byte varints
+  t->controlChunk = new UINT8[KnobBufferSize.Value () * 5 / 2 + 
+			     TRACE_REPEAT_TRAILER];
+
+  InitHeader (&t->dataHeader, TRACE_STREAM_DATA, 
+	      !KnobCompact ? TRACE_DATA_RAW :
+	      KnobPredict ? TRACE_DATA_PREDICTED : TRACE_DATA_COMPACT, tid);
+  if (KnobElide)
+    t->dataHeader.flags |= TRACE_FLAG_STATIC_ELIDED;
+  t->dataHeader.flags |= TRACE_FLAG_STACK_POINTER;
+  if (KnobImmutable)
+    t->dataHeader.flags |= TRACE_FLAG_IMMUTABLE_ELIDED;
+  SnapshotRegisters (&t->dataHeader, ctxt);
+  t->startStackPointer = PIN_GetContextReg (ctxt, REG_ESP);
+  t->regionInstructions = 0;
+  t->segment = 0;
+  t->segmentStart = 0;
+  t->syscallControlRecords = ~0ULL;
+  t->pending = t->endRequested = t->stopped = false;
+  t->opaque = false;
+  t->allocDepth = t->lifetimes = 0;
+  t->copyDepth = 0;
+  t->copyPending = false;
+  t->ring = NULL;
+
+  // the flight recorder opens the trace files when dumping
+  if (KnobRing)
+    t->ring = new deque<TraceChunk>;
+  else
+    OpenTraceFiles (tid);
+
+  GetLock (&traceLock, tid + 1);
+  t->epochFile = new ofstream (TraceFileName ("epoch", tid).c_str ());
+  ReleaseLock (&traceLock);
+
+  PathFrame thread;
+  thread.slot = ~0U;
+  thread.units = thread.depth = thread.executed = 0;
+  thread.block = NULL;
+  t->pathFrames.assign (1, thread);
+  t->pathInstructions = 0;
+
+  RecordEpoch (tid);
+}
+
+VOID ThreadFini (THREADID tid, const CONTEXT *ctxt, INT32 code, VOID *v)
+{
+  ThreadTrace *t = &threadTraces[tid];
+  ADDRINT framePointer = 0;
+  BOOL framePointerKnown = true;
+
+  // already ended by CrashSignal
+  if (t->data.base == NULL)
+    return;
+
+  // a thread may end in excluded code or in the allocator
+  if (pathControl)
+    ClosePaths (tid);
+  if (t->lifetimes)
+    RecordLifetimes (tid);
+  if (t->copyPending)
+    RecordCopy (tid);
+  if (t->opaque)
+    RecordOpaque (tid);
+  FlushBuffers (tid, 0, false);
+  RecordEpoch (tid);
+
+  // the slicer starts tracking EBP from its value at the end of the trace.
+  // Threads still alive at exit come without context, the one exiting the
+  // process has logged nothing since it entered exit_group. Threads that 
+  // missed the end of the region logged nothing since their last system 
+  // call, or their frame pointer is lost.
+  if (ctxt && roiState != ROI_ENDED)
+    framePointer = PIN_GetContextReg (ctxt, REG_EBP);
+  else if (t->syscallControlRecords == t->controlRecords)
+    framePointer = t->syscallFramePointer;
+  else
+    framePointerKnown = false;
+
+  if (t->ring)
+    DumpRing (tid, framePointer, framePointerKnown);
+  else if (!t->stopped)
+    {
+      if (framePointerKnown)
+	{
+	  t->dataHeader.framePointer = framePointer;
+	  t->dataHeader.flags |= TRACE_FLAG_FRAME_POINTER;
+	}
+      SnapshotStackLimit (t);
+      t->dataFile->Patch (0, &t->dataHeader, sizeof (t->dataHeader));
+    }
+
+  FreeBuffer (&t->data);
+  FreeBuffer (&t->control);
+  delete [] t->chunk;
+  delete [] t->controlChunk;
+
+  CloseTraceFiles (tid);
+  GetLock (&traceLock, tid + 1);
+  delete t->epochFile;
+  ReleaseLock (&traceLock);
+}
+
+//! @brief counts the faulting instruction as executed, its data records
+//         are already logged
+static VOID
+CompleteFaultingInstruction (THREADID tid, ADDRINT ip)
+{
+  if (!blockControl)
+    {
+      RecordControlPred (tid, (VOID *) ip);
+      return;
+    }
+
+  // the block of the faulting instruction ends with it
+  TruncateBlock (tid, ip, 1);
+}
+
+//! @brief dumps the flight recorders at the dump signal
+BOOL DumpSignal (THREADID tid, INT32 sig, CONTEXT *ctxt, BOOL hasHandler,
+		 const EXCEPTION_INFO *info, VOID *v)
+{
+  RequestDump ();
+  return false;
+}
+
+//! @brief ends the trace of a thread killed by a synchronous signal, 
+//         which never gets to its ThreadFini
+BOOL CrashSignal (THREADID tid, INT32 sig, CONTEXT *ctxt, BOOL hasHandler,
+		  const EXCEPTION_INFO *info, VOID *v)
+{
+  if (!hasHandler && threadTraces[tid].data.base)
+    {
+      ADDRINT ip = PIN_GetContextReg (ctxt, REG_INST_PTR);
+      if (!threadTraces[tid].opaque)
+	CompleteFaultingInstruction (tid, ip);
+      ThreadFini (tid, ctxt, 0, v);
+    }
+  return true;
+}
+
+//! @brief ends the traces of all threads once Pin let go of them at the
+//         end of the region, see StopRegion
+VOID Detach (VOID *v)
+{
+  for (THREADID tid = 0; tid < MAX_THREADS; tid++)
+    if (threadTraces[tid].data.base)
+      ThreadFini (tid, NULL, 0, v);
+}
+
 VOID Fini(INT32 code, VOID *v)
 {  
+  // threads still alive at exit never see their ThreadFini
+  for (THREADID tid = 0; tid < MAX_THREADS; tid++)
+    if (threadTraces[tid].data.base)
+      ThreadFini (tid, NULL, code, v);
+
+  UINT64 insCount = 0;
+  for (THREADID tid = 0; tid < MAX_THREADS; tid++)
+    insCount += threadTraces[tid].instructions;
   cerr << "Instruction Count = " << insCount << endl;
-  traceDataFile.close ();
-  traceControlFile.close ();
 }
 
 /* ===================================================================== */
@@ -202,15 +3087,110 @@ int main(int argc, char *argv[])
         return Usage();
       }
     
-    traceDataFile.open (".trace.data");
-    traceControlFile.open (".trace.control");
+    if (KnobBufferSize.Value () <= 2 * BUFFER_SLACK)
+      {
+        return Usage();
+      }
+
+    if (KnobControl.Value () == "bbl")
+      blockControl = true;
+    else if (KnobControl.Value () == "paths")
+      blockControl = pathControl = true;
+    else if (KnobControl.Value () != "ins")
+      return Usage ();
+    controlRecordSize = blockControl ? sizeof (BlockRecord) : sizeof (VOID *);
+
+    if (KnobSink.Value () == "mmap")
+      {
+	// without writer thread, extents are mapped when they are needed
+	SinkInit ();
+      }
+    else if (KnobSink.Value () == "shm")
+      {
+	if (!ShmInit (KnobShmName.Value (), KnobShmSize.Value (), 
+		      KnobShmWait.Value ()))
+	  return Usage ();
+      }
+    else if (KnobSink.Value () != "stream")
+      return Usage ();
+
+    for (UINT32 i = 0; i < KnobInclude.NumberOfValues (); i++)
+      if (!ParseFilter (KnobInclude.Value (i), &includeFilter))
+	return Usage ();
+    for (UINT32 i = 0; i < KnobExclude.NumberOfValues (); i++)
+      if (!ParseFilter (KnobExclude.Value (i), &excludeFilter))
+	return Usage ();
+    if (!includeFilter.names.empty () || !excludeFilter.names.empty () ||
+	KnobLifetimes || KnobRanges)
+      PIN_InitSymbols ();
+
+    InitLock (&traceLock);
+
+    if (KnobStopAction.Value () != "stop" && 
+	KnobStopAction.Value () != "detach")
+      return Usage ();
+    roiState = KnobStartIp || KnobStartAfter ? ROI_WAITING : ROI_RECORDING;
+    startAfter = KnobStartAfter ? KnobStartAfter.Value () : ~0ULL;
+
+    if (KnobRecord)
+      {
+	// the traces come from a replay of the recording
+	if (KnobDeps || !KnobReplay.Value ().empty ())
+	  return Usage ();
+	ReplayRecordInit (KnobSink.Value ());
+	if (KnobSink.Value () == "shm")
+	  PIN_AddFiniFunction (ShmFini, 0);
+	PIN_StartProgram();
+	return 0;
+      }
+    if (!KnobReplay.Value ().empty ())
+      ReplayInit (KnobReplay.Value ());
+
+    if (KnobDeps)
+      {
+	// selection, the region, segments & the flight recorder need the
+	// traces
+	if (KnobRing || roiState == ROI_WAITING || KnobStopIp || KnobSegment ||
+	    KnobInclude.NumberOfValues () > 1 || 
+	    KnobExclude.NumberOfValues () > 1 ||
+	    !KnobInclude.Value ().empty () || !KnobExclude.Value ().empty ())
+	  return Usage ();
+	DepInit (KnobBufferSize.Value (), KnobSink.Value ());
+	if (KnobSink.Value () == "shm")
+	  PIN_AddFiniFunction (ShmFini, 0);
+	PIN_StartProgram();
+	return 0;
+      }
     
-    INS_AddInstrumentFunction(Instruction, 0);
+    // the flight recorder keeps its chunks until dumped as one segment
+    if (KnobSegment && KnobRing)
+      return Usage ();
+
+    // path records are decoded from the start of the trace
+    if (pathControl && (KnobSegment || KnobRing || 
+			!LoadPathChains (KnobPaths.Value ().c_str ())))
+      return Usage ();
+
+    IMG_AddInstrumentFunction(ImageLoad, 0);
+    TRACE_AddInstrumentFunction(Trace, 0);
+    PIN_AddSyscallEntryFunction(SyscallEntry, 0);
+    PIN_AddThreadStartFunction(ThreadStart, 0);
+    PIN_AddThreadFiniFunction(ThreadFini, 0);
     PIN_AddFiniFunction(Fini, 0);
+    // after Fini, which still writes out flight recorders
+    if (KnobSink.Value () == "shm")
+      PIN_AddFiniFunction (ShmFini, 0);
+    PIN_AddDetachFunction(Detach, 0);
+
+    PIN_InterceptSignal (SIGSEGV, CrashSignal, 0);
+    PIN_InterceptSignal (SIGBUS, CrashSignal, 0);
+    PIN_InterceptSignal (SIGILL, CrashSignal, 0);
+    PIN_InterceptSignal (SIGFPE, CrashSignal, 0);
+    if (KnobRing && KnobDumpSignal)
+      PIN_InterceptSignal (KnobDumpSignal, DumpSignal, 0);
 
     // Never returns
     PIN_StartProgram();    
     
     return 0;
 }
-
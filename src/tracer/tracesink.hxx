@@ -0,0 +1,542 @@
+/*! @file
+ *  tracesink : output backends of the tracers. A mapped sink copies trace
+ *  bytes into a memory mapped file, whose extents are mapped ahead and
+ *  retired by an internal writer thread, so that application threads do
+ *  not enter the kernel while tracing. A shm sink streams them to a
+ *  concurrent consumer instead, through a ring in shared memory.
+ */
+
+#ifndef __TRACESINK_HXX
+#define __TRACESINK_HXX
+
+#include "pin.H"
+#include "tracering.hxx"
+#include <fstream>
+#include <iostream>
+#include <string.h>
+
+extern "C"
+{
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+}
+
+// size of the file window an application thread writes into at once
+#define SINK_EXTENT (16 << 20)
+
+// lock owner id of the writer thread, beyond any application thread id
+#define SINK_WRITER_OWNER (1 << 16)
+
+class TraceSink
+{
+public:
+  virtual ~TraceSink () {}
+  virtual VOID Write (const VOID *buffer, UINT32 size) = 0;
+  //! @brief overwrites bytes already written, e.g. a header completed
+  //         when the trace ends
+  virtual VOID Patch (UINT64 offset, const VOID *buffer, UINT32 size) = 0;
+  virtual VOID Close () = 0;
+  //! @return bytes in the current output window of the sink, 0 if it
+  //          has none
+  virtual UINT32 Buffered () { return 0; }
+};
+
+//! @class sink writing through an ofstream
+class StreamSink: public TraceSink
+{
+  std::ofstream file;
+public:
+  StreamSink (const char *path) : file (path, std::ios::binary) {}
+  VOID Write (const VOID *buffer, UINT32 size) 
+  { file.write ((const char *) buffer, size); }
+  VOID Patch (UINT64 offset, const VOID *buffer, UINT32 size);
+  VOID Close () { file.close (); }
+};
+
+VOID
+StreamSink::Patch (UINT64 offset, const VOID *buffer, UINT32 size)
+{
+  std::streampos end = file.tellp ();
+
+  file.seekp (offset, std::ios::beg);
+  file.write ((const char *) buffer, size);
+  file.seekp (end);
+}
+
+//! @class sink writing into a mapped file. Only the owning thread writes;
+//         the writer thread maps the extent following the current one and
+//         unmaps the retired one.
+class MappedSink: public TraceSink
+{
+  int fd;
+  UINT64 offset;               // file offset of the current extent
+  UINT8 *current;
+  UINT32 used;                 // bytes written into the current extent
+
+  // shared with the writer thread
+  UINT8 * volatile next;
+  UINT8 * volatile retired;
+  UINT64 mapEnd;               // file offset following the last mapping
+  PIN_SEMAPHORE nextReady;
+
+  VOID NextExtent ();
+public:
+  MappedSink *link;            // sinks served by the writer thread
+  
+  MappedSink (const char *path);
+  BOOL IsOpen () { return current != NULL; }
+  VOID Write (const VOID *buffer, UINT32 size);
+  VOID Patch (UINT64 at, const VOID *buffer, UINT32 size);
+  VOID Close ();
+  VOID Serve ();
+  UINT32 Buffered () { return used; }
+};
+
+static MappedSink *sinks;
+static PIN_LOCK sinkLock;
+static PIN_SEMAPHORE sinkWork;
+static PIN_THREAD_UID sinkWriterUid;
+static volatile BOOL sinkWriterRunning;
+
+static UINT8 *
+MapExtent (int fd, UINT64 offset)
+{
+  if (ftruncate (fd, offset + SINK_EXTENT) != 0)
+    return NULL;
+
+  // populating the extent here spares the application thread the faults
+  VOID *extent = mmap (NULL, SINK_EXTENT, PROT_READ | PROT_WRITE, 
+		       MAP_SHARED | MAP_POPULATE, fd, offset);
+  return extent == MAP_FAILED ? NULL : (UINT8 *) extent;
+}
+
+MappedSink::MappedSink (const char *path)
+{
+  offset = used = 0;
+  next = retired = NULL;
+  mapEnd = SINK_EXTENT;
+  PIN_SemaphoreInit (&nextReady);
+
+  fd = open (path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  current = fd < 0 ? NULL : MapExtent (fd, 0);
+  if (current == NULL)
+    return;
+
+  GetLock (&sinkLock, PIN_ThreadId () + 1);
+  link = sinks;
+  sinks = this;
+  ReleaseLock (&sinkLock);
+  PIN_SemaphoreSet (&sinkWork);
+}
+
+//! @brief moves on to the extent mapped ahead by the writer thread. Blocks
+//         only if the writer thread lags a whole extent behind.
+VOID
+MappedSink::NextExtent ()
+{
+  UINT8 *old = __sync_lock_test_and_set (&retired, current);
+  if (old)
+    munmap (old, SINK_EXTENT);
+
+  if (!sinkWriterRunning)
+    {
+      // no writer thread (yet or anymore), map synchronously
+      GetLock (&sinkLock, PIN_ThreadId () + 1);
+      Serve ();
+      ReleaseLock (&sinkLock);
+    }
+  PIN_SemaphoreWait (&nextReady);
+  PIN_SemaphoreClear (&nextReady);
+  current = next;
+  next = NULL;
+  offset += SINK_EXTENT;
+  used = 0;
+  PIN_SemaphoreSet (&sinkWork);
+  ASSERTX (current != NULL);
+}
+
+VOID
+MappedSink::Write (const VOID *buffer, UINT32 size)
+{
+  const UINT8 *bytes = (const UINT8 *) buffer;
+
+  while (size > 0)
+    {
+      UINT32 n = size < SINK_EXTENT - used ? size : SINK_EXTENT - used;
+      memcpy (current + used, bytes, n);
+      used += n;
+      bytes += n;
+      size -= n;
+      if (used == SINK_EXTENT)
+	NextExtent ();
+    }
+}
+
+VOID
+MappedSink::Patch (UINT64 at, const VOID *buffer, UINT32 size)
+{
+  // the page cache keeps pwrite coherent with the mappings
+  if (pwrite (fd, buffer, size, at) != (ssize_t) size)
+    perror ("pwrite");
+}
+
+//! @brief writer side: maps the next extent & unmaps the retired one.
+//         Called with sinkLock held.
+VOID
+MappedSink::Serve ()
+{
+  UINT8 *old = __sync_lock_test_and_set (&retired, (UINT8 *) NULL);
+  if (old)
+    munmap (old, SINK_EXTENT);
+
+  if (next == NULL && !PIN_SemaphoreIsSet (&nextReady))
+    {
+      next = MapExtent (fd, mapEnd);
+      mapEnd += SINK_EXTENT;
+      PIN_SemaphoreSet (&nextReady);
+    }
+}
+
+VOID
+MappedSink::Close ()
+{
+  MappedSink **s;
+
+  GetLock (&sinkLock, PIN_ThreadId () + 1);
+  for (s = &sinks; *s != NULL; s = &(*s)->link)
+    if (*s == this)
+      {
+	*s = link;
+	break;
+      }
+  ReleaseLock (&sinkLock);
+
+  if (next)
+    munmap (next, SINK_EXTENT);
+  if (retired)
+    munmap (retired, SINK_EXTENT);
+  munmap (current, SINK_EXTENT);
+  if (ftruncate (fd, offset + used) != 0)
+    perror ("ftruncate");
+  close (fd);
+  PIN_SemaphoreFini (&nextReady);
+}
+
+static VOID
+SinkWriter (VOID *arg)
+{
+  BOOL running;
+
+  // serves once more after being stopped, application threads that
+  // switched extents before then rely on it
+  do
+    {
+      PIN_SemaphoreTimedWait (&sinkWork, 100);
+      PIN_SemaphoreClear (&sinkWork);
+      running = sinkWriterRunning;
+
+      GetLock (&sinkLock, SINK_WRITER_OWNER);
+      for (MappedSink *s = sinks; s != NULL; s = s->link)
+	s->Serve ();
+      ReleaseLock (&sinkLock);
+    }
+  while (running);
+}
+
+//! @brief stops the writer thread before Fini; Pin does not terminate
+//         internal threads by itself
+static VOID
+SinkPrepareForFini (VOID *v)
+{
+  sinkWriterRunning = false;
+  PIN_SemaphoreSet (&sinkWork);
+  PIN_WaitForThreadTermination (sinkWriterUid, PIN_INFINITE_TIMEOUT, NULL);
+}
+
+//! @brief starts the writer thread, to be called from main
+static BOOL
+SinkInit ()
+{
+  InitLock (&sinkLock);
+  PIN_SemaphoreInit (&sinkWork);
+  sinkWriterRunning = true;
+  if (PIN_SpawnInternalThread (SinkWriter, NULL, 0, &sinkWriterUid) 
+      == INVALID_THREADID)
+    {
+      sinkWriterRunning = false;
+      return false;
+    }
+  PIN_AddPrepareForFiniFunction (SinkPrepareForFini, 0);
+  return true;
+}
+
+/* ===================================================================== */
+
+//! @class sink streaming into a ring in shared memory, see tracering.hxx.
+//         Only the owning thread writes, or patches & closes at the end.
+class ShmSink: public TraceSink
+{
+  TraceRing *ring;
+  UINT32 mapSize;
+  UINT32 head;                 // bytes published, a copy of ring->head
+  std::string spillPath;
+  int spillFd;
+  UINT64 spillStart;           // spill file offset of the pending bytes
+  UINT32 spillPending;         // bytes spilled & not announced yet
+
+  BOOL Room (UINT32 bytes, UINT32 wait);
+  VOID Send (UINT32 kind, UINT64 offset, const VOID *buffer, UINT32 size);
+  BOOL Spill (const VOID *buffer, UINT32 size);
+  VOID AnnounceSpill ();
+public:
+  ShmSink (const char *path);
+  BOOL IsOpen () { return ring != NULL; }
+  VOID Write (const VOID *buffer, UINT32 size);
+  VOID Patch (UINT64 offset, const VOID *buffer, UINT32 size);
+  VOID Close ();
+  UINT32 Buffered () { return head - ring->tail; }
+};
+
+static TraceRingRegistry *shmRegistry;
+static std::string shmName;
+static UINT32 shmRingSize;
+static UINT32 shmWait;
+
+//! @return shared memory object of size bytes, created & mapped, or NULL
+static VOID *
+CreateShm (const std::string &name, UINT32 size)
+{
+  int fd = open (TraceShmPath (name).c_str (), O_RDWR | O_CREAT | O_TRUNC,
+		 0600);
+  if (fd < 0)
+    return NULL;
+
+  VOID *shm = NULL;
+  if (ftruncate (fd, size) == 0)
+    shm = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close (fd);
+  return shm == MAP_FAILED ? NULL : shm;
+}
+
+ShmSink::ShmSink (const char *path)
+{
+  UINT32 n;
+
+  ring = NULL;
+  head = spillStart = 0;
+  spillPending = 0;
+  spillFd = -1;
+  spillPath = std::string (path) + ".spill";
+  if (strlen (path) >= TRACE_RING_NAME)
+    return;
+
+  // the consumer frees the slots of the rings it is done with
+  for (n = 0; n < TRACE_RING_STREAMS; n++)
+    if (__sync_bool_compare_and_swap (&shmRegistry->streams[n].state,
+				      TRACE_RING_FREE, TRACE_RING_CLAIMED))
+      break;
+  if (n == TRACE_RING_STREAMS)
+    return;
+
+  mapSize = sizeof (TraceRing) + shmRingSize;
+  ring = (TraceRing *) CreateShm (TraceRingName (shmName, n), mapSize);
+  if (ring == NULL)
+    {
+      shmRegistry->streams[n].state = TRACE_RING_FREE;
+      return;
+    }
+  ring->size = shmRingSize;
+  ring->magic = TRACE_RING_MAGIC;
+  strcpy (shmRegistry->streams[n].name, path);
+  __sync_synchronize ();
+  shmRegistry->streams[n].state = TRACE_RING_READY;
+}
+
+//! @return whether bytes are free in the ring, waiting up to wait ms for
+//          the consumer to free them. Like the rest of the ring, waiting
+//          is plain POSIX, as on the side of shmdrain.
+BOOL
+ShmSink::Room (UINT32 bytes, UINT32 wait)
+{
+  for (UINT32 waited = 0; ; waited++)
+    {
+      if (ring->size - (head - ring->tail) >= bytes)
+	return true;
+      if (waited >= wait)
+	return false;
+      usleep (1000);
+    }
+}
+
+//! @brief publishes a message, for which there must be room
+VOID
+ShmSink::Send (UINT32 kind, UINT64 offset, const VOID *buffer, UINT32 size)
+{
+  TraceMessage message;
+
+  message.kind = kind;
+  message.size = size;
+  message.offset = offset;
+  TraceRingCopyIn (ring, head, &message, sizeof (message));
+  if (buffer)
+    TraceRingCopyIn (ring, head + sizeof (message), buffer, size);
+
+  // the consumer sees the head move only once the message is complete
+  __sync_synchronize ();
+  head += TraceMessageBytes (buffer ? size : 0);
+  ring->head = head;
+}
+
+//! @return false if the bytes could not be spilled
+BOOL
+ShmSink::Spill (const VOID *buffer, UINT32 size)
+{
+  if (spillFd < 0)
+    spillFd = open (spillPath.c_str (), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (spillFd < 0)
+    return false;
+  if (write (spillFd, buffer, size) != (ssize_t) size)
+    {
+      // drop a partial write, the announced offsets must hold
+      if (ftruncate (spillFd, spillStart + spillPending) != 0)
+	perror ("ftruncate");
+      lseek (spillFd, spillStart + spillPending, SEEK_SET);
+      return false;
+    }
+  spillPending += size;
+  return true;
+}
+
+VOID
+ShmSink::AnnounceSpill ()
+{
+  Send (TRACE_MESSAGE_SPILL, spillStart, NULL, spillPending);
+  spillStart += spillPending;
+  spillPending = 0;
+}
+
+VOID
+ShmSink::Write (const VOID *buffer, UINT32 size)
+{
+  const UINT8 *bytes = (const UINT8 *) buffer;
+
+  // messages of at most a quarter of the ring never wait for one another
+  while (size > 0)
+    {
+      UINT32 n = size < ring->size / 4 ? size : ring->size / 4;
+
+      // bytes spilled are announced before anything sent after them
+      if (spillPending && Room (TraceMessageBytes (0), 0))
+	AnnounceSpill ();
+      if (!spillPending && Room (TraceMessageBytes (n), shmWait))
+	Send (TRACE_MESSAGE_DATA, 0, bytes, n);
+      else if (!Spill (bytes, n))
+	{
+	  // without a spill file, wait for the consumer after all
+	  if (spillPending)
+	    {
+	      Room (TraceMessageBytes (0), ~0U);
+	      AnnounceSpill ();
+	    }
+	  Room (TraceMessageBytes (n), ~0U);
+	  Send (TRACE_MESSAGE_DATA, 0, bytes, n);
+	}
+      bytes += n;
+      size -= n;
+    }
+}
+
+//! @brief waits for the consumer, patches only come at the end of a trace
+VOID
+ShmSink::Patch (UINT64 offset, const VOID *buffer, UINT32 size)
+{
+  ASSERTX (TraceMessageBytes (size) <= ring->size / 4);
+  if (spillPending)
+    {
+      Room (TraceMessageBytes (0), ~0U);
+      AnnounceSpill ();
+    }
+  Room (TraceMessageBytes (size), ~0U);
+  Send (TRACE_MESSAGE_PATCH, offset, buffer, size);
+}
+
+VOID
+ShmSink::Close ()
+{
+  if (spillPending)
+    {
+      Room (TraceMessageBytes (0), ~0U);
+      AnnounceSpill ();
+    }
+  __sync_synchronize ();
+  ring->closed = true;
+  munmap (ring, mapSize);
+  if (spillFd >= 0)
+    close (spillFd);
+}
+
+//! @brief creates the registry of the rings, to be called from main
+//  @return false if it cannot be created
+static BOOL
+ShmInit (const std::string &name, UINT32 ringSize, UINT32 wait)
+{
+  shmName = name;
+  shmWait = wait;
+
+  // the ring offsets wrap by masking
+  for (shmRingSize = 1 << 16; shmRingSize < ringSize; shmRingSize <<= 1)
+    ;
+
+  shmRegistry = 
+    (TraceRingRegistry *) CreateShm (name, sizeof (TraceRingRegistry));
+  if (shmRegistry == NULL || 
+      getcwd (shmRegistry->directory, TRACE_RING_PATH) == NULL)
+    return false;
+  shmRegistry->magic = TRACE_RING_MAGIC;
+  return true;
+}
+
+//! @brief tells the consumer that no more rings are coming, once those
+//         open are closed
+static VOID
+ShmFini (INT32 code, VOID *v)
+{
+  __sync_synchronize ();
+  shmRegistry->done = true;
+}
+
+//! @return sink of the given kind, "mmap", "stream" or "shm", or NULL on
+//          failure
+static TraceSink *
+OpenSink (const std::string &kind, const char *path)
+{
+  if (kind == "stream")
+    return new StreamSink (path);
+  if (kind == "shm" && shmRegistry)
+    {
+      static BOOL warned = false;
+      ShmSink *sink = new ShmSink (path);
+      if (sink->IsOpen ())
+	return sink;
+      delete sink;
+
+      // all rings in use, or no ring for this file: the consumer never
+      // sees it, but the trace stays whole
+      if (!warned)
+	std::cerr << "no shm ring for " << path << ", writing it and any "
+		  << "later such file in place" << std::endl;
+      warned = true;
+      return new StreamSink (path);
+    }
+  
+  MappedSink *sink = new MappedSink (path);
+  if (!sink->IsOpen ())
+    {
+      delete sink;
+      return NULL;
+    }
+  return sink;
+}
+
+#endif
@@ -0,0 +1,56 @@
+/*! @file
+ *  tracestore : moves trace files written by the naive tracer into a
+ *  store, see tracestore.hxx, leaving a manifest in place of each. The
+ *  slicer reads manifests as it reads the files themselves. Files that are
+ *  manifests already are left as they are.
+ *
+ *  usage: tracestore <store> <trace file>...
+ */
+
+#include "tracestore.hxx"
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+//! @brief replaces a trace file by its manifest
+static bool
+Store (const string &store, const char *path)
+{
+  TraceStoreReader manifest;
+  TraceStoreWriter writer (store, path);
+  ifstream file (path, ios::in | ios::binary);
+  vector<char> buffer (1 << 20);
+
+  if (manifest.Open (path))
+    return true;
+  if (!file)
+    {
+      perror (path);
+      return false;
+    }
+  while (file.read (&buffer[0], buffer.size ()) || file.gcount () > 0)
+    if (!writer.Data (&buffer[0], file.gcount ()))
+      break;
+  if (file.bad () || !writer.Close ())
+    {
+      cerr << path << ": could not store trace" << endl;
+      return false;
+    }
+  return true;
+}
+
+int
+main (int argc, char **argv)
+{
+  bool ok = true;
+
+  if (argc < 3)
+    {
+      cerr << "usage: " << argv[0] << " <store> <trace file>..." << endl;
+      return 1;
+    }
+  for (int i = 2; i < argc; i++)
+    ok &= Store (argv[1], argv[i]);
+  return ok ? 0 : 1;
+}